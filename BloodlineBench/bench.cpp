@@ -0,0 +1,369 @@
+﻿//====================================================================
+//  BloodlineBench  ―― 合成血統表によるマイクロ / マクロベンチマーク
+//
+//    本体 (main.cpp) を BLOODLINE_NO_MAIN 付きでそのまま取り込み、
+//    ped / cfg / store / lru も本体と同じものを使って測る。
+//
+//    使い方:
+//      BloodlineBench gen --horses N [--gens G] [--seed S] [--sires F] [--skew X]
+//                         [--inbreed R] [--cycles C] --out FILE
+//          合成血統表 (bloodline.csv と同じ列構成) を書き出すだけ
+//      BloodlineBench run [--horses N] [--gens G] [--seed S] [--sires F] [--skew X]
+//                         [--inbreed R] [--cycles C] [--reps R] [--samples M] [--targets T]
+//                         [--threads N] [--work DIR] [--json FILE] [--only NAME,...]
+//          WORK に血統表を作って各ベンチマークを R 回ずつ実行し、結果を JSON に書く
+//
+//    ベンチマーク:
+//      macro  generate            合成血統表の生成 (1 回だけ)
+//      macro  load_csv            loadBloodlineCSV (スナップショット無し)
+//      macro  load_snapshot       loadBloodlineCSV (スナップショットあり)
+//      micro  getBlood_cold       LRU を空にし RocksDB を作り直してから M 組の血量
+//      micro  getBlood_warm       同じ M 組をもう一度 (LRU に載った状態)
+//      micro  collectAncestors    M 頭ぶん
+//      micro  collectDescendants  M 頭ぶん
+//      micro  closure_multi       T 頭の祖先・子孫の和集合を 1 回の走査で
+//      macro  saveDescFast        File-A, 対象 1 頭 (最多産駒の種牡馬)
+//      macro  saveAncVert         File-B, 対象 1 頭 (最も新しい世代の馬)
+//      macro  saveCSVMatrix_Smart File-A / File-B, 対象 T 頭
+//
+//    Linux でのビルド (リポジトリ直下の CMakeLists.txt。本体も一緒にできる):
+//      cmake -S . -B build && cmake --build build -j
+//====================================================================
+#define BLOODLINE_NO_MAIN
+#include "main.cpp"
+#include "synth_pedigree.h"
+
+namespace bench {
+
+//  計測中は本体の進捗ログを捨てる
+struct NullBuf : std::streambuf {
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+struct Silence {
+    NullBuf null;
+    std::streambuf* saved;
+    Silence() : saved(std::cout.rdbuf(&null)) {}
+    ~Silence() { std::cout.rdbuf(saved); }
+};
+
+struct Result {
+    std::string name, kind;               // kind = "micro" | "macro"
+    size_t items = 0;                     // 1 回あたりの処理件数 (行 / 組 / 頭)
+    std::uintmax_t bytes = 0;             // 1 回あたりの入出力バイト数 (無ければ 0)
+    std::vector<double> ms;               // 回ごとの所要時間
+
+    double minMs() const { return *std::min_element(ms.begin(), ms.end()); }
+    double maxMs() const { return *std::max_element(ms.begin(), ms.end()); }
+    double meanMs() const { double s = 0; for (double x : ms) s += x; return s / ms.size(); }
+    double medianMs() const {
+        std::vector<double> v = ms;
+        std::sort(v.begin(), v.end());
+        return v.size() % 2 ? v[v.size() / 2] : 0.5 * (v[v.size() / 2 - 1] + v[v.size() / 2]);
+    }
+};
+
+struct Options {
+    SynthConfig synth;
+    unsigned reps = 3;
+    size_t samples = 2000;               // micro で使う馬 / 組の数
+    size_t targets = 8;                  // saveCSVMatrix_Smart の対象頭数
+    std::string work = "bench_work";
+    std::string json = "bench.json";
+    std::string out;                      // gen の出力先
+    std::vector<std::string> only;        // 空 = 全部
+};
+
+using Clock = std::chrono::steady_clock;
+
+//  setup (計測外) → body (計測) を reps 回
+template <class Setup, class Body>
+Result measure(const std::string& name, const std::string& kind, unsigned reps, size_t items,
+    Setup setup, Body body)
+{
+    Result r;
+    r.name = name;  r.kind = kind;  r.items = items;
+    for (unsigned i = 0; i < reps; ++i) {
+        setup();
+        Silence quiet;
+        auto t0 = Clock::now();
+        body();
+        r.ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    return r;
+}
+
+void printResult(const Result& r) {
+    const double med = r.medianMs();
+    std::printf("%-22s %-5s reps=%zu  min=%10.3f  med=%10.3f  max=%10.3f ms  %12.0f items/s\n",
+        r.name.c_str(), r.kind.c_str(), r.ms.size(), r.minMs(), med, r.maxMs(),
+        med > 0 ? r.items / (med / 1e3) : 0.0);
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string o;
+    for (char c : s) {
+        if (c == '"' || c == '\\') { o += '\\';  o += c; }
+        else if ((unsigned char)c < 0x20) { char b[8];  std::snprintf(b, sizeof b, "\\u%04x", c);  o += b; }
+        else o += c;
+    }
+    return o;
+}
+
+bool writeJson(const std::string& path, const Options& o, const SynthStats& ss,
+    const std::vector<Result>& results)
+{
+    std::ofstream f(path, std::ios::binary);
+    if (!f) return false;
+    char num[64];
+    auto d = [&](double v) { std::snprintf(num, sizeof num, "%.6f", v);  return std::string(num); };
+
+    f << "{\n  \"config\": {\"horses\": " << o.synth.horses << ", \"generations\": " << o.synth.generations
+        << ", \"seed\": " << o.synth.seed << ", \"sire_fraction\": " << d(o.synth.sireFraction)
+        << ", \"sire_skew\": " << d(o.synth.sireSkew) << ", \"inbreed_rate\": " << d(o.synth.inbreedRate)
+        << ", \"cycles\": " << o.synth.cycles << ", \"reps\": " << o.reps << ", \"samples\": " << o.samples
+        << ", \"targets\": " << o.targets << ", \"threads\": " << cfg.threads << "},\n";
+    f << "  \"pedigree\": {\"horses\": " << ped.size() << ", \"founders\": " << ss.founders
+        << ", \"stallions\": " << ss.stallions << ", \"inbred\": " << ss.inbred
+        << ", \"cycles\": " << ss.cycles << ", \"acyclic\": " << (ped.acyclic ? "true" : "false")
+        << ", \"csv_bytes\": " << ss.bytes << "},\n";
+    f << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        const double med = r.medianMs();
+        f << "    {\"name\": \"" << jsonEscape(r.name) << "\", \"kind\": \"" << r.kind
+            << "\", \"reps\": " << r.ms.size() << ", \"items\": " << r.items
+            << ", \"bytes\": " << r.bytes
+            << ", \"min_ms\": " << d(r.minMs()) << ", \"median_ms\": " << d(med)
+            << ", \"mean_ms\": " << d(r.meanMs()) << ", \"max_ms\": " << d(r.maxMs())
+            << ", \"items_per_sec\": " << d(med > 0 ? r.items / (med / 1e3) : 0.0)
+            << ", \"ms\": [";
+        for (size_t k = 0; k < r.ms.size(); ++k) f << (k ? ", " : "") << d(r.ms[k]);
+        f << "]}" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    f << "  ]\n}\n";
+    return bool(f);
+}
+
+//------------------------- コマンドライン -------------------------------
+void parse(int argc, char** argv, int first, Options& o) {
+    for (int i = first; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) { std::cerr << a << " には値が必要です\n"; exit(1); }
+            return argv[++i];
+        };
+        if (a == "--horses") o.synth.horses = std::stoull(value());
+        else if (a == "--gens") o.synth.generations = unsigned(std::stoul(value()));
+        else if (a == "--seed") o.synth.seed = std::stoull(value());
+        else if (a == "--sires") o.synth.sireFraction = std::stod(value());
+        else if (a == "--skew") o.synth.sireSkew = std::stod(value());
+        else if (a == "--inbreed") o.synth.inbreedRate = std::stod(value());
+        else if (a == "--cycles") o.synth.cycles = std::stoull(value());
+        else if (a == "--reps") o.reps = std::max(1u, unsigned(std::stoul(value())));
+        else if (a == "--samples") o.samples = std::max<size_t>(1, std::stoull(value()));
+        else if (a == "--targets") o.targets = std::max<size_t>(1, std::stoull(value()));
+        else if (a == "--threads") {
+            int n = std::stoi(value());
+            cfg.threads = n > 0 ? unsigned(n) : std::max(1u, std::thread::hardware_concurrency());
+        }
+        else if (a == "--work") o.work = value();
+        else if (a == "--json") o.json = value();
+        else if (a == "--out") o.out = value();
+        else if (a == "--only") {
+            std::stringstream ss(value());
+            for (std::string t; std::getline(ss, t, ','); ) if (!trim(t).empty()) o.only.push_back(trim(t));
+        }
+        else { std::cerr << "unknown option: " << a << '\n'; exit(1); }
+    }
+}
+
+int runGen(const Options& o) {
+    if (o.out.empty()) { std::cerr << "gen には --out FILE が必要です\n"; return 1; }
+    SynthStats ss;
+    if (!writeSynthPedigree(o.out, o.synth, &ss)) { std::cerr << "cannot write " << o.out << '\n'; return 1; }
+    std::printf("[gen] %s: horses=%zu founders=%zu stallions=%zu inbred=%zu cycles=%zu, %.1f MB, %.3f s\n",
+        o.out.c_str(), ss.horses, ss.founders, ss.stallions, ss.inbred, ss.cycles,
+        ss.bytes / (1024.0 * 1024.0), ss.seconds);
+    return 0;
+}
+
+int runAll(const Options& o) {
+    namespace fs = std::filesystem;
+    auto wanted = [&](const std::string& n) {
+        return o.only.empty() || std::find(o.only.begin(), o.only.end(), n) != o.only.end();
+    };
+    std::error_code ec;
+    fs::create_directories(o.work + "/out", ec);
+    if (ec) { std::cerr << "cannot create " << o.work << ": " << ec.message() << '\n';  return 1; }
+    const std::string csv = o.work + "/bloodline.csv";
+    const std::string snap = o.work + "/bloodline.snap";
+    const std::string outDir = o.work + "/out";
+    cfg.dbPath = o.work + "/blood_cache_db";
+    cfg.quiet = true;
+    std::vector<Result> results;
+    auto add = [&](Result r) { printResult(r);  results.push_back(std::move(r)); };
+
+    // --- 生成 (常に実行: 以降のベンチマークの入力) ---
+    SynthStats ss;
+    {
+        Result r = measure("generate", "macro", 1, o.synth.horses, [] {}, [&] {
+            if (!writeSynthPedigree(csv, o.synth, &ss)) { std::cerr << "cannot write " << csv << '\n';  exit(1); }
+        });
+        r.bytes = ss.bytes;
+        add(std::move(r));
+    }
+
+    // --- 読込 ---
+    const std::uintmax_t csvBytes = fs::file_size(csv, ec);
+    cfg.snapshotPath = o.work + "/none.snap";       // 存在しない → 必ず CSV を解析
+    fs::remove(cfg.snapshotPath, ec);
+    if (wanted("load_csv")) {
+        Result r = measure("load_csv", "macro", o.reps, o.synth.horses,
+            [] { ped = Pedigree(); }, [&] { loadBloodlineCSV(csv); });
+        r.bytes = csvBytes;
+        add(std::move(r));
+    }
+    else { ped = Pedigree();  Silence q;  loadBloodlineCSV(csv); }
+
+    if (wanted("load_snapshot")) {
+        std::uint64_t h = 0;
+        snapshot::hashFile(csv, h);
+        writeSnapshot(snap, ped, h);
+        cfg.snapshotPath = snap;
+        Result r = measure("load_snapshot", "macro", o.reps, o.synth.horses,
+            [] { ped = Pedigree(); }, [&] { loadBloodlineCSV(csv); });
+        r.bytes = fs::file_size(snap, ec);
+        add(std::move(r));
+    }
+    std::printf("[bench] horses=%zu, acyclic=%s\n", size_t(ped.size()), ped.acyclic ? "yes" : "no");
+
+    // --- 標本: 乱数で選んだ馬と、その祖先 1 頭の組 ---
+    synth::Rng rng{ o.synth.seed ^ 0x5bd1e995u };
+    std::vector<HorseId> sample;
+    std::vector<std::pair<HorseId, HorseId>> pairs;
+    for (size_t tries = 0; pairs.size() < o.samples && tries < o.samples * 20; ++tries) {
+        const HorseId h = rng.below(ped.size());
+        if (sample.size() < o.samples) sample.push_back(h);
+        HorseSet anc;
+        collectAncestors(h, anc);
+        if (anc.empty()) continue;
+        // 祖先全体から一様に 1 頭 (HorseSet は ID 昇順なので先頭から選ぶと若い ID に偏る)
+        HorseId pick = NO_HORSE;
+        size_t seen = 0;
+        for (HorseId x : anc) if (rng.below(++seen) == 0) pick = x;    // リザーバサンプリング (1 頭)
+        pairs.emplace_back(h, pick);
+    }
+
+    // --- 血量 (LRU → RocksDB → 再帰) ---
+    if (wanted("getBlood_cold") || wanted("getBlood_warm")) {
+        // 全組が LRU に載る容量にして warm を純粋なヒットにする
+        lru.resize(std::max<size_t>(cfg.cacheMB, 256));
+        double sink = 0;
+        auto body = [&] {
+            for (const auto& p : pairs) { std::unordered_set<HorseId> stk;  sink += getBlood(p.first, p.second, stk); }
+        };
+        add(measure("getBlood_cold", "micro", o.reps, pairs.size(), [&] {
+            store.close();
+            fs::remove_all(cfg.dbPath, ec);
+            Silence q;
+            store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat);
+            lru.clear();
+        }, body));
+        if (wanted("getBlood_warm")) add(measure("getBlood_warm", "micro", o.reps, pairs.size(), [] {}, body));
+        if (sink < 0) std::puts("");                 // 最適化で消されないように
+    }
+    if (!store.raw()) { Silence q;  store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat); }
+
+    // --- 祖先・子孫セット ---
+    size_t setSink = 0;
+    if (wanted("collectAncestors"))
+        add(measure("collectAncestors", "micro", o.reps, sample.size(), [] {}, [&] {
+            for (HorseId h : sample) { HorseSet s;  collectAncestors(h, s);  setSink += s.size(); }
+        }));
+    if (wanted("collectDescendants"))
+        add(measure("collectDescendants", "micro", o.reps, sample.size(), [] {}, [&] {
+            for (HorseId h : sample) { HorseSet s;  collectDescendants(h, s);  setSink += s.size(); }
+        }));
+    if (wanted("closure_multi")) {
+        const std::vector<HorseId> multi(sample.begin(), sample.begin() + std::min(o.targets, sample.size()));
+        add(measure("closure_multi", "micro", o.reps, multi.size(), [] {}, [&] {
+            HorseSet a, d;
+            ancestorsOf(ped, multi, a);  descendantsOf(ped, multi, d);
+            setSink += a.size() + d.size();
+        }));
+    }
+    if (setSink == 0) std::puts("");
+
+    // --- 書き出し ---
+    //  File-A の対象 = 産駒が最も多い馬 (子孫が多い), File-B の対象 = 最後の馬 (祖先が多い)
+    HorseId sireTop = 0;
+    for (HorseId h = 1; h < ped.size(); ++h)
+        if (ped.childrenEnd(h) - ped.childrenBegin(h) > ped.childrenEnd(sireTop) - ped.childrenBegin(sireTop))
+            sireTop = h;
+    const HorseId youngest = ped.yearOrder.back();
+    const std::vector<HorseId>& allKeys = ped.yearOrder;
+    auto fileSize = [&](const std::string& p) { return fs::file_size(p, ec); };
+
+    if (wanted("saveDescFast")) {
+        HorseSet setDesc;
+        collectDescendants(sireTop, setDesc);
+        const std::string f = outDir + "/descfast.csv";
+        Result r = measure("saveDescFast", "macro", o.reps, allKeys.size(), [] {}, [&] {
+            saveDescFast(f, allKeys, setDesc, sireTop);
+        });
+        r.bytes = fileSize(f);
+        add(std::move(r));
+    }
+    if (wanted("saveAncVert")) {
+        HorseSet setAnc;
+        collectAncestors(youngest, setAnc);
+        const std::string f = outDir + "/ancvert.csv";
+        Result r = measure("saveAncVert", "macro", o.reps, allKeys.size(), [] {}, [&] {
+            saveAncVert(f, allKeys, setAnc, youngest);
+        });
+        r.bytes = fileSize(f);
+        add(std::move(r));
+    }
+    if (wanted("saveCSVMatrix_Smart")) {
+        std::vector<HorseId> targets;
+        HorseSet setAnc, setDesc;
+        for (size_t i = 0; i < o.targets && i < sample.size(); ++i) targets.push_back(sample[i]);
+        std::sort(targets.begin(), targets.end(), [](HorseId a, HorseId b) { return ped.key[a] < ped.key[b]; });
+        targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+        ancestorsOf(ped, targets, setAnc);
+        descendantsOf(ped, targets, setDesc);
+
+        const std::string fa = outDir + "/matrix_A.csv", fb = outDir + "/matrix_B.csv";
+        Result ra = measure("saveCSVMatrix_Smart_A", "macro", o.reps, allKeys.size() * targets.size(), [] {}, [&] {
+            saveCSVMatrix_Smart(fa, allKeys, targets, false, [&](auto row, auto) { return setDesc.count(row); });
+        });
+        ra.bytes = fileSize(fa);
+        add(std::move(ra));
+        Result rb = measure("saveCSVMatrix_Smart_B", "macro", o.reps, allKeys.size() * targets.size(), [] {}, [&] {
+            saveCSVMatrix_Smart(fb, targets, allKeys, true, [&](auto, auto col) { return setAnc.count(col); });
+        });
+        rb.bytes = fileSize(fb);
+        add(std::move(rb));
+    }
+
+    store.close();
+    if (!writeJson(o.json, o, ss, results)) { std::cerr << "cannot write " << o.json << '\n';  return 1; }
+    std::printf("[bench] %s を書き出しました\n", o.json.c_str());
+    return 0;
+}
+
+} // namespace bench
+
+int main(int argc, char** argv) {
+    if (argc < 2 || (std::string(argv[1]) != "gen" && std::string(argv[1]) != "run")) {
+        std::cerr << "usage: BloodlineBench gen --horses N [--gens G] [--seed S] --out FILE\n"
+                     "       BloodlineBench run [--horses N] [--gens G] [--reps R] [--json FILE] ...\n";
+        return 1;
+    }
+    bench::Options o;
+    bench::parse(argc, argv, 2, o);
+    lru.resize(cfg.cacheMB);
+    return std::string(argv[1]) == "gen" ? bench::runGen(o) : bench::runAll(o);
+}
@@ -0,0 +1,213 @@
+﻿#pragma once
+//====================================================================
+//  allpairs.h  ―― 全馬 × 全馬の血量行列 (CPU 版。旧 gpumain.cpp の置き換え)
+//
+//    行(h) = e_h + (行(父) + 行(母)) / 2   (値 [h][j] = 馬 j の血が h に何 % 入っているか)
+//    ・行は世代順 (topo 順を世代で安定整列したもの) に作るので親が必ず先にある
+//    ・列を幅 TILE の帯 (タイル) に分ける。タイルは互いに独立なので
+//      タイル単位で並列に作る (1 タイル = N 行 × TILE 列の連続領域, 行優先)
+//    ・行の平均は AVX-512 / AVX2 (コンパイル時に有効なら) でまとめて計算。
+//      /arch:AVX2 や -mavx2 -mfma 無しのビルドでもスカラー版で同じ値になる
+//    ・タイル内で値が 0 でない行 (= タイルの列の馬の子孫) だけを計算する
+//    ・float32 を選ぶとメモリ半分。全体が memMB に収まらなければ
+//      タイルを作るそばからスピルファイルへ書き、出力時に行ブロック単位で読み戻す
+//    ※ ped.acyclic == true が前提
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "parallel.h"
+#include "pedigree.h"
+
+struct AllPairsOptions {
+    bool        f32 = false;         // 値を float で持つ (メモリ半分, 有効桁 7)
+    size_t      memMB = 4'000;       // 行列 (またはタイル作業領域) に使ってよいメモリ
+    unsigned    threads = 1;
+    std::string spillPath;           // スピルファイル (必要になったときだけ作る)
+};
+
+struct AllPairsStats {
+    size_t tiles = 0, tileCols = 0;
+    bool   spilled = false;
+    std::uint64_t liveCells = 0;     // 計算したセル数 (0 と分かっている行は飛ばす)
+    double seconds = 0;
+};
+
+namespace allpairs {
+
+constexpr size_t TILE = 256;          // メモリに収まるときのタイル幅 (1 行 2KB @f64)
+constexpr size_t LANE = 16;           // タイル幅の刻み (AVX-512 の float 16 本)
+
+//  dst = 0.5 * a + 0.5 * b   (getBlood と同じ式。親が 1 頭なら b = nullptr)
+inline void averageRows(double* dst, const double* a, const double* b, size_t n) {
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512d h = _mm512_set1_pd(0.5);
+    if (b) for (; i + 8 <= n; i += 8)
+        _mm512_storeu_pd(dst + i, _mm512_add_pd(_mm512_mul_pd(h, _mm512_loadu_pd(a + i)),
+            _mm512_mul_pd(h, _mm512_loadu_pd(b + i))));
+    else for (; i + 8 <= n; i += 8) _mm512_storeu_pd(dst + i, _mm512_mul_pd(h, _mm512_loadu_pd(a + i)));
+#elif defined(__AVX2__)
+    const __m256d h = _mm256_set1_pd(0.5);
+    if (b) for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_mul_pd(h, _mm256_loadu_pd(a + i)),
+            _mm256_mul_pd(h, _mm256_loadu_pd(b + i))));
+    else for (; i + 4 <= n; i += 4) _mm256_storeu_pd(dst + i, _mm256_mul_pd(h, _mm256_loadu_pd(a + i)));
+#endif
+    if (b) for (; i < n; ++i) dst[i] = 0.5 * a[i] + 0.5 * b[i];
+    else   for (; i < n; ++i) dst[i] = 0.5 * a[i];
+}
+
+inline void averageRows(float* dst, const float* a, const float* b, size_t n) {
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512 h = _mm512_set1_ps(0.5f);
+    if (b) for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_mul_ps(h, _mm512_loadu_ps(a + i)),
+            _mm512_mul_ps(h, _mm512_loadu_ps(b + i))));
+    else for (; i + 16 <= n; i += 16) _mm512_storeu_ps(dst + i, _mm512_mul_ps(h, _mm512_loadu_ps(a + i)));
+#elif defined(__AVX2__)
+    const __m256 h = _mm256_set1_ps(0.5f);
+    if (b) for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(h, _mm256_loadu_ps(a + i)),
+            _mm256_mul_ps(h, _mm256_loadu_ps(b + i))));
+    else for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, _mm256_mul_ps(h, _mm256_loadu_ps(a + i)));
+#endif
+    if (b) for (; i < n; ++i) dst[i] = 0.5f * a[i] + 0.5f * b[i];
+    else   for (; i < n; ++i) dst[i] = 0.5f * a[i];
+}
+
+} // namespace allpairs
+
+template <class T>
+class AllPairsMatrix {
+public:
+    AllPairsMatrix(const Pedigree& p, const AllPairsOptions& o) : ped(p), opt(o), n(p.size()) {
+        const size_t budget = opt.memMB * 1024 * 1024;
+        const unsigned th = std::max(1u, opt.threads);
+        inMemory = n * n * sizeof(T) <= budget;
+        if (inMemory) tileCols = allpairs::TILE;
+        else {
+            // 同時に作るタイル (スレッド数ぶん) が budget に収まる幅
+            tileCols = budget / (std::max<size_t>(1, n) * sizeof(T) * th);
+            tileCols = std::max(allpairs::LANE, tileCols / allpairs::LANE * allpairs::LANE);
+        }
+        tileCols = std::min(tileCols, std::max<size_t>(1, n));
+        tiles = n ? (n + tileCols - 1) / tileCols : 0;
+    }
+    ~AllPairsMatrix() { if (!inMemory && !opt.spillPath.empty()) std::remove(opt.spillPath.c_str()); }
+
+    size_t size() const { return n; }
+
+    //  全タイルを作る (メモリ上 or スピルファイル)
+    bool build(AllPairsStats* st = nullptr) {
+        auto t0 = std::chrono::steady_clock::now();
+        order = generationOrder(ped);
+        orderPos.assign(n, 0);
+        for (size_t i = 0; i < order.size(); ++i) orderPos[order[i]] = std::uint32_t(i);
+
+        WorkStealingPool pool(opt.threads);
+        std::vector<std::unique_ptr<std::fstream>> out(pool.size());
+        std::vector<std::vector<T>> work(pool.size());
+        if (inMemory) mem.assign(tiles, {});
+        else {
+            std::ofstream(opt.spillPath, std::ios::binary | std::ios::trunc);   // 空で作る
+            for (auto& f : out) {
+                f = std::make_unique<std::fstream>(opt.spillPath, std::ios::binary | std::ios::in | std::ios::out);
+                if (!*f) return false;
+            }
+        }
+
+        std::atomic<std::uint64_t> live{ 0 };
+        std::atomic<bool> ok{ true };
+        pool.run(tiles, [&](size_t t, unsigned w) {
+            const size_t c0 = t * tileCols, c1 = std::min(n, c0 + tileCols), k = c1 - c0;
+            std::vector<T>& buf = inMemory ? mem[t] : work[w];
+            buf.assign(n * k, T(0));
+            live += buildTile(c0, c1, buf.data());
+            if (!inMemory) {
+                std::fstream& f = *out[w];
+                f.seekp(std::streamoff(tileOffset(t)));
+                f.write(reinterpret_cast<const char*>(buf.data()), std::streamsize(buf.size() * sizeof(T)));
+                if (!f) ok = false;
+            }
+        });
+        for (auto& f : out) if (f) f->close();
+
+        if (st) {
+            st->tiles = tiles;  st->tileCols = tileCols;  st->spilled = !inMemory;
+            st->liveCells = live;
+            st->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+        return ok;
+    }
+
+    //  行 [r0, r1) を行優先 (1 行 = n 列) で dst に読み出す。reader はスレッドごとに持つ
+    struct Reader { std::ifstream f; std::vector<T> tmp; };
+    bool readRows(size_t r0, size_t r1, double* dst, Reader& rd) const {
+        const size_t rows = r1 - r0;
+        for (size_t t = 0; t < tiles; ++t) {
+            const size_t c0 = t * tileCols, k = std::min(n, c0 + tileCols) - c0;
+            const T* src;
+            if (inMemory) src = mem[t].data() + r0 * k;
+            else {
+                if (!rd.f.is_open()) rd.f.open(opt.spillPath, std::ios::binary);
+                rd.tmp.resize(rows * k);
+                rd.f.seekg(std::streamoff(tileOffset(t) + r0 * k * sizeof(T)));
+                rd.f.read(reinterpret_cast<char*>(rd.tmp.data()), std::streamsize(rows * k * sizeof(T)));
+                if (!rd.f) return false;
+                src = rd.tmp.data();
+            }
+            for (size_t r = 0; r < rows; ++r)
+                for (size_t j = 0; j < k; ++j) dst[r * n + c0 + j] = double(src[r * k + j]);
+        }
+        return true;
+    }
+
+private:
+    // タイル t のファイル内位置 (タイル t は N 行 × 幅 k の行優先で連続)
+    std::uint64_t tileOffset(size_t t) const { return std::uint64_t(n) * t * tileCols * sizeof(T); }
+
+    // 列 [c0, c1) のタイルを buf (0 埋め済み, 行 = 馬 ID) に作る。計算したセル数を返す
+    std::uint64_t buildTile(size_t c0, size_t c1, T* buf) const {
+        const size_t k = c1 - c0;
+        std::vector<std::uint8_t> live(n, 0);       // タイル内で 0 でない行
+        size_t first = order.size();
+        for (size_t j = c0; j < c1; ++j) first = std::min<size_t>(first, orderPos[j]);
+
+        std::uint64_t cells = 0;
+        for (size_t i = first; i < order.size(); ++i) {
+            const HorseId h = order[i];
+            const HorseId s = ped.sire[h], d = ped.dam[h];
+            const bool ls = s != NO_HORSE && live[s], ld = d != NO_HORSE && live[d];
+            T* row = buf + size_t(h) * k;
+            if (ls || ld) {
+                const T* a = buf + size_t(ls ? s : d) * k;
+                const T* b = ls && ld ? buf + size_t(d) * k : nullptr;
+                allpairs::averageRows(row, a, b, k);
+                live[h] = 1;  cells += k;
+            }
+            if (h >= c0 && h < c1) { row[h - c0] = T(1);  live[h] = 1; }   // 自分自身
+        }
+        return cells;
+    }
+
+    const Pedigree& ped;
+    AllPairsOptions opt;
+    size_t n, tileCols = 0, tiles = 0;
+    bool inMemory = true;
+    std::vector<HorseId> order;
+    std::vector<std::uint32_t> orderPos;
+    std::vector<std::vector<T>> mem;          // inMemory 時のタイル
+};
@@ -0,0 +1,178 @@
+﻿#pragma once
+//====================================================================
+//  ancestry.h  ―― 「全馬の血が対象馬に何 % 含まれるか」(File-B) 用の
+//                  疎な祖先ベクトル {祖先 ID → 血量}
+//
+//    ・1 頭ぶん : 対象馬から父・母へ重みを逆向きに押し上げる (1.0 → 0.5 → …)
+//                 子は必ず親より先に処理する (topo 位置の降順) ので、
+//                 1 回の走査で全経路の寄与が足し込まれる
+//    ・複数頭   : 兄弟で共有される父・母のベクトルを使い回し
+//                 vec(h) = {h:1} + 0.5·vec(父) + 0.5·vec(母) の併合 1 回で済ませる
+//    ※ どちらも ped.acyclic == true が前提
+//====================================================================
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "pedigree.h"
+
+using AncestryVec = std::vector<std::pair<HorseId, double>>;   // ID 昇順
+
+// 疎ベクトルから 1 要素を取り出す (無ければ 0)
+inline double ancestryGet(const AncestryVec& v, HorseId anc) {
+    auto it = std::lower_bound(v.begin(), v.end(), anc,
+        [](const std::pair<HorseId, double>& e, HorseId id) { return e.first < id; });
+    return (it != v.end() && it->first == anc) ? it->second : 0.0;
+}
+
+//--------------------------------------------------------------------
+//  直列化 (RocksDB の 1 値 = 1 頭ぶんのベクトル)
+//    [形式 1B: 0=double, 1=float] [件数 varint] [ID 差分 varint × n] [重み × n]
+//--------------------------------------------------------------------
+inline void putVarint(std::string& s, std::uint32_t x) {
+    while (x >= 0x80) { s.push_back(char(x | 0x80)); x >>= 7; }
+    s.push_back(char(x));
+}
+inline bool getVarint(const char*& p, const char* end, std::uint32_t& x) {
+    x = 0;
+    for (int sh = 0; p < end && sh <= 28; sh += 7) {
+        std::uint8_t b = std::uint8_t(*p++);
+        x |= std::uint32_t(b & 0x7F) << sh;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline void encodeAncestry(const AncestryVec& v, bool asFloat, std::string& out) {
+    out.clear();
+    out.push_back(asFloat ? 1 : 0);
+    putVarint(out, (std::uint32_t)v.size());
+    HorseId prev = 0;
+    for (const auto& e : v) { putVarint(out, e.first - prev); prev = e.first; }
+    for (const auto& e : v) {
+        if (asFloat) { float f = float(e.second); out.append(reinterpret_cast<const char*>(&f), sizeof f); }
+        else out.append(reinterpret_cast<const char*>(&e.second), sizeof(double));
+    }
+}
+
+inline bool decodeAncestry(const char* p, size_t len, AncestryVec& v) {
+    const char* end = p + len;
+    if (p == end) return false;
+    const bool asFloat = *p++ == 1;
+    std::uint32_t n;
+    if (!getVarint(p, end, n)) return false;
+    v.resize(n);
+    HorseId id = 0;
+    for (auto& e : v) {
+        std::uint32_t d;
+        if (!getVarint(p, end, d)) return false;
+        id += d;  e.first = id;
+    }
+    const size_t w = asFloat ? sizeof(float) : sizeof(double);
+    if (size_t(end - p) != n * w) return false;
+    for (auto& e : v) {
+        if (asFloat) { float f; std::memcpy(&f, p, sizeof f); e.second = f; }
+        else std::memcpy(&e.second, p, sizeof(double));
+        p += w;
+    }
+    return true;
+}
+
+class AncestryEngine {
+public:
+    explicit AncestryEngine(const Pedigree& p) : ped(p), weight(p.size(), 0.0) {}
+
+    //---------------- 1 頭ぶん: 逆向き伝播 ----------------
+    void compute(HorseId tgt, AncestryVec& out) {
+        // 祖先 (自身を含む) を集める
+        touched.clear();
+        touched.push_back(tgt);  weight[tgt] = 1.0;
+        for (size_t i = 0; i < touched.size(); ++i) {
+            const HorseId h = touched[i];
+            for (HorseId p : { ped.sire[h], ped.dam[h] })
+                if (p != NO_HORSE && weight[p] == 0.0) { weight[p] = -1.0; touched.push_back(p); }
+        }
+        for (size_t i = 1; i < touched.size(); ++i) weight[touched[i]] = 0.0;
+
+        // 子 → 親 の順に重みを半分ずつ押し上げる
+        std::sort(touched.begin(), touched.end(),
+            [&](HorseId a, HorseId b) { return ped.topoPos[a] > ped.topoPos[b]; });
+        for (HorseId h : touched) {
+            const double w = 0.5 * weight[h];
+            if (ped.sire[h] != NO_HORSE) weight[ped.sire[h]] += w;
+            if (ped.dam[h] != NO_HORSE)  weight[ped.dam[h]] += w;
+        }
+
+        out.clear();  out.reserve(touched.size());
+        for (HorseId h : touched) { out.emplace_back(h, weight[h]); weight[h] = 0.0; }
+        std::sort(out.begin(), out.end());
+    }
+
+    //---------------- 複数頭: 父・母ベクトルの併合 ----------------
+    //  out[j] = targets[j] の祖先ベクトル
+    void computeMany(const std::vector<HorseId>& targets, std::vector<AncestryVec>& out) {
+        out.assign(targets.size(), {});
+
+        // 2 頭以上の対象馬から参照される親 / 対象馬自身が親になるものは保持して再利用
+        std::unordered_map<HorseId, unsigned> refs;
+        for (HorseId t : targets)
+            for (HorseId p : { ped.sire[t], ped.dam[t] })
+                if (p != NO_HORSE) ++refs[p];
+        std::unordered_map<HorseId, size_t> targetCol;
+        for (size_t j = 0; j < targets.size(); ++j) targetCol.emplace(targets[j], j);
+
+        std::unordered_map<HorseId, AncestryVec> shared;
+        auto parentVec = [&](HorseId p) -> const AncestryVec* {
+            if (p == NO_HORSE) return &empty;
+            auto it = shared.find(p);
+            if (it != shared.end()) return &it->second;
+            auto tc = targetCol.find(p);
+            if (tc != targetCol.end() && !out[tc->second].empty()) return &out[tc->second];
+            if (refs[p] < 2) return nullptr;
+            compute(p, shared[p]);
+            return &shared[p];
+        };
+
+        // 親が先に処理されるよう topo 順で回す
+        std::vector<size_t> ord(targets.size());
+        for (size_t j = 0; j < ord.size(); ++j) ord[j] = j;
+        std::sort(ord.begin(), ord.end(),
+            [&](size_t a, size_t b) { return ped.topoPos[targets[a]] < ped.topoPos[targets[b]]; });
+
+        for (size_t j : ord) {
+            const HorseId t = targets[j];
+            const AncestryVec* vs = parentVec(ped.sire[t]);
+            const AncestryVec* vd = parentVec(ped.dam[t]);
+            if (vs && vd) merge(t, *vs, *vd, out[j]);
+            else          compute(t, out[j]);
+        }
+    }
+
+private:
+    // {h:1} + 0.5·a + 0.5·b  (どちらも ID 昇順)
+    static void merge(HorseId h, const AncestryVec& a, const AncestryVec& b, AncestryVec& out) {
+        out.clear();  out.reserve(a.size() + b.size() + 1);
+        size_t i = 0, j = 0;
+        bool self = false;
+        auto emitSelf = [&](HorseId next) {
+            if (!self && h < next) { out.emplace_back(h, 1.0); self = true; }
+        };
+        while (i < a.size() || j < b.size()) {
+            HorseId ia = i < a.size() ? a[i].first : NO_HORSE;
+            HorseId ib = j < b.size() ? b[j].first : NO_HORSE;
+            HorseId id = std::min(ia, ib);
+            emitSelf(id);
+            double va = (ia == id) ? a[i++].second : 0.0;
+            double vb = (ib == id) ? b[j++].second : 0.0;
+            out.emplace_back(id, 0.5 * va + 0.5 * vb);
+        }
+        emitSelf(NO_HORSE);
+    }
+
+    const Pedigree&      ped;
+    std::vector<double>  weight;    // 全馬ぶんの作業領域 (使用後は 0 に戻す)
+    std::vector<HorseId> touched;
+    const AncestryVec    empty;
+};
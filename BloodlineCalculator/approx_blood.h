@@ -0,0 +1,126 @@
+﻿#pragma once
+//====================================================================
+//  approx_blood.h  ―― 深さ制限・寄与の下限つきの近似血量 (--max-depth / --min-contrib)
+//
+//    1 世代さかのぼるごとに重みは半分になる。
+//      ・maxDepth  : 対象馬から maxDepth 代までの経路だけを数える (0 = 制限なし)
+//      ・minWeight : 重みが minWeight 未満になった枝を切る (0 = 切らない)
+//    切り捨てた重みの合計 bound が誤差の上限になる:
+//      出力値 ≤ 厳密値 ≤ 出力値 + bound   (その対象馬のどの祖先でも)
+//    (切った枝の重み m は、その先で m × 血量 ≤ m しか寄与しないため)
+//
+//    ・循環なし : 世代ごとの層で重みを押し上げる。同じ層で合流した経路は
+//                 まとめてから minWeight と比べる (1 頭ぶんの費用 ≒ 深さ × 層の幅)
+//    ・循環あり : getBlood と同じ再帰 (stk で循環を切る) に枝切りを足したもの
+//    結果は厳密値と混ざらないよう、キャッシュも出力ファイル名も条件ごとに分ける
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "ancestry.h"
+#include "pedigree.h"
+
+struct ApproxOptions {
+    unsigned maxDepth = 0;          // 0 = 制限なし
+    double   minWeight = 0.0;       // 0 = 切らない
+
+    bool enabled() const { return maxDepth > 0 || minWeight > 0.0; }
+    //  出力ファイル名・ログ用 ("d8", "e0.0001", "d8_e0.0001")
+    std::string tag() const {
+        std::ostringstream s;
+        if (maxDepth) s << 'd' << maxDepth;
+        if (maxDepth && minWeight > 0.0) s << '_';
+        if (minWeight > 0.0) s << 'e' << minWeight;
+        return s.str();
+    }
+};
+
+//  近似の祖先ベクトルと誤差の上限
+struct ApproxVec {
+    AncestryVec v;                  // ID 昇順 (自身 = 1.0 を含む)
+    double      bound = 0.0;
+};
+
+//  実行中に使った近似値の集計 (誤差の上限は最大値を残す)
+struct ApproxStats {
+    std::atomic<std::uint64_t> vectors{ 0 }, computed{ 0 };
+    std::atomic<double> maxBound{ 0.0 };
+
+    void note(double b) {
+        double m = maxBound.load(std::memory_order_relaxed);
+        while (b > m && !maxBound.compare_exchange_weak(m, b, std::memory_order_relaxed)) {}
+    }
+    void reset() { vectors = 0;  computed = 0;  maxBound = 0.0; }
+};
+
+class ApproxAncestryEngine {
+public:
+    ApproxAncestryEngine(const Pedigree& p, const ApproxOptions& o)
+        : ped(p), opt(o), sum(p.size(), 0.0), acc(p.size(), 0.0) {}
+
+    //  tgt の近似祖先ベクトル。※ ped.acyclic == true が前提
+    void compute(HorseId tgt, ApproxVec& out) {
+        double dropped = 0.0;
+        seen.clear();
+        layer.assign(1, { tgt, 1.0 });
+        for (unsigned k = 0; !layer.empty(); ++k) {
+            for (const auto& e : layer) {
+                if (sum[e.first] == 0.0) seen.push_back(e.first);
+                sum[e.first] += e.second;
+            }
+            // k 代目の親 (k+1 代目) へ半分ずつ。深さの上限ならここで全部切る
+            nextIds.clear();
+            for (const auto& e : layer)
+                for (HorseId p : { ped.sire[e.first], ped.dam[e.first] }) {
+                    if (p == NO_HORSE) continue;
+                    if (acc[p] == 0.0) nextIds.push_back(p);
+                    acc[p] += 0.5 * e.second;
+                }
+            const bool last = opt.maxDepth && k + 1 > opt.maxDepth;
+            layer.clear();
+            for (HorseId p : nextIds) {
+                const double w = acc[p];
+                acc[p] = 0.0;
+                if (last || w < opt.minWeight) dropped += w;
+                else layer.emplace_back(p, w);
+            }
+        }
+
+        out.v.clear();  out.v.reserve(seen.size());
+        for (HorseId h : seen) { out.v.emplace_back(h, sum[h]);  sum[h] = 0.0; }
+        std::sort(out.v.begin(), out.v.end());
+        out.bound = dropped;
+    }
+
+private:
+    const Pedigree&      ped;
+    ApproxOptions        opt;
+    std::vector<double>  sum, acc;   // 全馬ぶんの作業領域 (使用後は 0 に戻す)
+    std::vector<HorseId> seen, nextIds;
+    std::vector<std::pair<HorseId, double>> layer;
+};
+
+//  循環のある血統用の 1 セル。getBlood と同じ再帰に枝切りを足したもの。
+//  w = 最初の対象馬から tgt までの経路の重み。切った枝の重みを dropped に足す
+inline double approxBloodPaths(const Pedigree& ped, HorseId tgt, HorseId anc, const ApproxOptions& o,
+    std::unordered_set<HorseId>& stk, unsigned depth, double w, double& dropped)
+{
+    if (tgt == NO_HORSE) return 0.0;
+    if (tgt == anc) return 1.0;
+    if (stk.count(tgt)) return 0.0;
+    double v = 0.0;
+    stk.insert(tgt);
+    for (HorseId p : { ped.sire[tgt], ped.dam[tgt] }) {
+        if (p == NO_HORSE) continue;
+        const double pw = 0.5 * w;
+        if ((o.maxDepth && depth + 1 > o.maxDepth) || pw < o.minWeight) { dropped += pw;  continue; }
+        v += 0.5 * approxBloodPaths(ped, p, anc, o, stk, depth + 1, pw, dropped);
+    }
+    stk.erase(tgt);
+    return v;
+}
@@ -0,0 +1,128 @@
+﻿#pragma once
+//====================================================================
+//  batch_plan.h  ―― バッチ実行 (--batch) のジョブ並べ替えとグループ化
+//
+//    ・ジョブごとに「対象馬 + 全祖先」の MinHash 署名を作り、推定 Jaccard が
+//      最大の未処理ジョブを貪欲に次へ並べる
+//      → 祖先を共有するジョブが隣り合い、LRU / RocksDB が温かいまま使える
+//    ・並べた順に、対象馬の和集合が maxCols 列を超えない所で区切ってグループにする。
+//      前進スイープと祖先ベクトルはグループ単位で 1 回だけ計算し (SharedWork)、
+//      各ジョブはそこから自分の列を取り出す
+//====================================================================
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ancestry.h"
+#include "pedigree.h"
+#include "propagate.h"
+
+struct BatchJob {
+    std::string          query;      // ジョブファイルの 1 行
+    size_t               line = 0;   // 行番号 (1 始まり。出力フォルダ名に使う)
+    std::vector<HorseId> targets;    // 解析済みの対象馬 (PrimaryKey 順)
+    std::string          label;      // idLabel
+};
+
+//  グループ内のジョブで共有する計算結果。載っていない対象馬は各ジョブが自前で計算する
+struct SharedWork {
+    DescBloodTable sweep;                                  // File-A 用。列番号は sweepCol
+    std::unordered_map<HorseId, std::uint32_t> sweepCol;
+    std::unordered_map<HorseId, AncestryVec>   anc;        // File-B 用の祖先ベクトル
+    std::unordered_map<HorseId, double>        ancBound;   // 近似モードでの anc の誤差の上限
+
+    bool sweepColumn(HorseId t, std::uint32_t& col) const {
+        auto it = sweepCol.find(t);
+        if (it == sweepCol.end()) return false;
+        col = it->second;
+        return true;
+    }
+    void clear() { sweep = DescBloodTable(); sweepCol.clear(); anc.clear(); ancBound.clear(); }
+};
+
+namespace batchplan {
+
+constexpr size_t SIG_K = 32;                  // MinHash の本数
+constexpr size_t GREEDY_MAX_JOBS = 2048;      // これを超えたら署名順ソートで代用 (O(J²) を避ける)
+using Signature = std::array<std::uint64_t, SIG_K>;
+
+inline std::uint64_t mix(std::uint64_t x) {   // splitmix64
+    x += 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//  対象馬 + 全祖先の MinHash 署名。mark は全馬ぶんの作業領域 (stamp が一致 = 訪問済み)
+inline void signature(const Pedigree& ped, const std::vector<HorseId>& targets,
+    std::vector<std::uint32_t>& mark, std::uint32_t stamp, Signature& sig)
+{
+    sig.fill(UINT64_MAX);
+    std::vector<HorseId> stack;
+    for (HorseId t : targets) if (mark[t] != stamp) { mark[t] = stamp; stack.push_back(t); }
+    while (!stack.empty()) {
+        const HorseId h = stack.back();  stack.pop_back();
+        const std::uint64_t base = mix(h);
+        for (size_t k = 0; k < SIG_K; ++k) sig[k] = std::min(sig[k], mix(base + k));
+        for (HorseId p : { ped.sire[h], ped.dam[h] })
+            if (p != NO_HORSE && mark[p] != stamp) { mark[p] = stamp; stack.push_back(p); }
+    }
+}
+
+inline size_t similarity(const Signature& a, const Signature& b) {
+    size_t n = 0;
+    for (size_t k = 0; k < SIG_K; ++k) n += (a[k] == b[k]);
+    return n;
+}
+
+//  jobs (対象馬が 1 頭以上あるもの) を実行順に並べ、グループに分けて返す
+//  戻り値は jobs の添字。maxCols = 1 グループで共有スイープできる列数の上限
+inline std::vector<std::vector<size_t>> scheduleJobs(const Pedigree& ped,
+    const std::vector<BatchJob>& jobs, size_t maxCols)
+{
+    const size_t n = jobs.size();
+    std::vector<Signature> sig(n);
+    std::vector<std::uint32_t> mark(ped.size(), 0);
+    for (size_t i = 0; i < n; ++i) signature(ped, jobs[i].targets, mark, std::uint32_t(i + 1), sig[i]);
+
+    // --- 並べ替え: 直前のジョブと最も似ているものを次に ---
+    std::vector<size_t> order;  order.reserve(n);
+    if (n <= GREEDY_MAX_JOBS) {
+        std::vector<char> done(n, 0);
+        for (size_t cur = 0; order.size() < n; ) {
+            order.push_back(cur);  done[cur] = 1;
+            size_t best = n, bestSim = 0;
+            for (size_t j = 0; j < n; ++j) {
+                if (done[j]) continue;
+                const size_t s = similarity(sig[cur], sig[j]);
+                if (best == n || s > bestSim) { best = j; bestSim = s; }
+            }
+            cur = best;
+        }
+    }
+    else {
+        for (size_t i = 0; i < n; ++i) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return sig[a] < sig[b]; });
+    }
+
+    // --- グループ化: 対象馬の和集合が maxCols を超えたら区切る ---
+    std::vector<std::vector<size_t>> groups;
+    std::fill(mark.begin(), mark.end(), 0);
+    std::uint32_t stamp = 1;
+    size_t cols = 0;
+    for (size_t j : order) {
+        size_t fresh = 0;
+        for (HorseId t : jobs[j].targets) fresh += (mark[t] != stamp);
+        if (groups.empty() || (cols > 0 && cols + fresh > maxCols)) {
+            groups.emplace_back();  ++stamp;  cols = 0;
+        }
+        for (HorseId t : jobs[j].targets) if (mark[t] != stamp) { mark[t] = stamp; ++cols; }
+        groups.back().push_back(j);
+    }
+    return groups;
+}
+
+}  // namespace batchplan
@@ -0,0 +1,156 @@
+﻿#pragma once
+//====================================================================
+//  blood_cache.h  ―― 血量のメモリ内キャッシュ (RocksDB の手前の 1 段目)
+//
+//    ・キー   : (tgt, anc) の ID 2 つを 64bit に詰めた固定長
+//    ・方式   : シャードごとの真の LRU (参照で先頭へ移動、末尾から追い出し)
+//    ・並列   : シャード単位のロック (キーのハッシュでシャードを選ぶ)
+//    ・容量   : MB 指定。1 エントリ ≒ ENTRY_BYTES として件数へ換算
+//    ・統計   : hit / miss / eviction を数える
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "pedigree.h"
+
+class BloodCache {
+public:
+    using Key = std::uint64_t;
+    static Key makeKey(HorseId tgt, HorseId anc) { return (Key(tgt) << 32) | anc; }
+
+    // ノード (24B) + ハッシュ表のノードとバケット ≒ 1 エントリの実コスト
+    static constexpr size_t ENTRY_BYTES = 72;
+    static constexpr size_t SHARDS = 64;
+
+    struct Stats { std::uint64_t hits, misses, evictions, entries; };
+
+    explicit BloodCache(size_t capacityMB) { resize(capacityMB); }
+
+    // 容量を変更する (縮小時は各シャードの末尾から追い出し、空いた領域も詰めて返す)。
+    // 実行中に別スレッド (メモリ番人) から呼んでもよい
+    void resize(size_t capacityMB) {
+        capMB = capacityMB;
+        const size_t total = capacityMB * 1024 * 1024 / ENTRY_BYTES;
+        const size_t per = std::max<size_t>(1, total / SHARDS);
+        perShard = per;
+        for (auto& s : shards) {
+            std::lock_guard<std::mutex> g(s.mu);
+            if (s.index.size() <= per && s.nodes.size() <= 2 * per) continue;
+            while (s.index.size() > per) evictOne(s);
+            s.compact();
+        }
+    }
+    size_t capacityMB() const { return capMB; }
+
+    bool get(Key k, double& v) {
+        Shard& s = shardOf(k);
+        std::lock_guard<std::mutex> g(s.mu);
+        auto it = s.index.find(k);
+        if (it == s.index.end()) { misses.fetch_add(1, std::memory_order_relaxed); return false; }
+        s.moveToFront(it->second);
+        v = s.nodes[it->second].val;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void put(Key k, double v) {
+        Shard& s = shardOf(k);
+        std::lock_guard<std::mutex> g(s.mu);
+        auto it = s.index.find(k);
+        if (it != s.index.end()) {                 // 既存キーは値を更新して先頭へ
+            s.nodes[it->second].val = v;
+            s.moveToFront(it->second);
+            return;
+        }
+        if (s.index.size() >= perShard.load(std::memory_order_relaxed)) evictOne(s);
+        std::uint32_t n;
+        if (!s.freeList.empty()) { n = s.freeList.back(); s.freeList.pop_back(); }
+        else { n = (std::uint32_t)s.nodes.size(); s.nodes.emplace_back(); }
+        s.nodes[n] = { k, v, NIL, NIL };
+        s.pushFront(n);
+        s.index.emplace(k, n);
+    }
+
+    void clear() {
+        for (auto& s : shards) {
+            std::lock_guard<std::mutex> g(s.mu);
+            decltype(s.index)().swap(s.index);
+            std::vector<Node>().swap(s.nodes);
+            std::vector<std::uint32_t>().swap(s.freeList);
+            s.head = s.tail = NIL;
+        }
+    }
+
+    Stats stats() const {
+        std::uint64_t n = 0;
+        for (auto& s : shards) { std::lock_guard<std::mutex> g(s.mu); n += s.index.size(); }
+        return { hits.load(), misses.load(), evictions.load(), n };
+    }
+
+private:
+    static constexpr std::uint32_t NIL = 0xFFFFFFFFu;
+
+    struct Node { Key key; double val; std::uint32_t prev, next; };
+
+    // splitmix64 の finalizer (対称なペアも散らばる)
+    static std::uint64_t mix(Key x) {
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    struct KeyHash { size_t operator()(Key x) const { return size_t(mix(x)); } };
+
+    struct Shard {
+        mutable std::mutex mu;
+        std::unordered_map<Key, std::uint32_t, KeyHash> index;
+        std::vector<Node> nodes;
+        std::vector<std::uint32_t> freeList;
+        std::uint32_t head = NIL, tail = NIL;     // head = 最近使用
+
+        void unlink(std::uint32_t n) {
+            Node& x = nodes[n];
+            if (x.prev != NIL) nodes[x.prev].next = x.next; else head = x.next;
+            if (x.next != NIL) nodes[x.next].prev = x.prev; else tail = x.prev;
+            x.prev = x.next = NIL;
+        }
+        void pushFront(std::uint32_t n) {
+            nodes[n].prev = NIL;  nodes[n].next = head;
+            if (head != NIL) nodes[head].prev = n; else tail = n;
+            head = n;
+        }
+        void moveToFront(std::uint32_t n) { if (head != n) { unlink(n); pushFront(n); } }
+        // 使用中のノードを LRU 順に詰め直す (空きノードとハッシュ表のバケットを解放)
+        void compact() {
+            std::vector<Node> nn;  nn.reserve(index.size());
+            std::unordered_map<Key, std::uint32_t, KeyHash> ni;  ni.reserve(index.size());
+            for (std::uint32_t n = head; n != NIL; n = nodes[n].next) {
+                const std::uint32_t m = (std::uint32_t)nn.size();
+                nn.push_back({ nodes[n].key, nodes[n].val, m ? m - 1 : NIL, NIL });
+                if (m) nn[m - 1].next = m;
+                ni.emplace(nodes[n].key, m);
+            }
+            head = nn.empty() ? NIL : 0;
+            tail = nn.empty() ? NIL : std::uint32_t(nn.size() - 1);
+            nodes.swap(nn);  index.swap(ni);
+            std::vector<std::uint32_t>().swap(freeList);
+        }
+    };
+
+    void evictOne(Shard& s) {
+        if (s.tail == NIL) return;
+        std::uint32_t n = s.tail;
+        s.unlink(n);
+        s.index.erase(s.nodes[n].key);
+        s.freeList.push_back(n);
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Shard& shardOf(Key k) { return shards[mix(k) >> 58]; }   // 上位 6bit = 64 シャード
+
+    Shard shards[SHARDS];
+    std::atomic<size_t> perShard{ 1 }, capMB{ 0 };
+    std::atomic<std::uint64_t> hits{ 0 }, misses{ 0 }, evictions{ 0 };
+};
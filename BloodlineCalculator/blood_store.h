@@ -0,0 +1,320 @@
+﻿#pragma once
+//====================================================================
+//  blood_store.h  ―― 計算済み血量の永続化 (RocksDB、2 段目のキャッシュ)
+//
+//    ・キー : tgt ID (4B, big endian) + anc ID (4B, big endian) の固定 8B
+//             → 同じ tgt のキーが連続し、先頭 4B を prefix として使える
+//    ・値   : double をそのまま 8B (文字列化による精度落ちなし)
+//    ・書込 : WriteBatch に溜め、一定件数ごとに裏スレッドで書き込む
+//             (書込待ちのバッチ数には上限があり、溢れたら計算側が待つ)
+//    ・ancvec 列ファミリ : 1 頭ぶんの祖先ベクトルを 1 値で保存 (キーは tgt 4B)
+//    ・approx 列ファミリ : 近似モード (approx_blood.h) の祖先ベクトル。厳密値とは分け、
+//             キーは tgt 4B + 深さ 4B + 下限 8B (条件が違えば別の値)。値 = 誤差上限 8B + ベクトル
+//    ・版   : 血統表の指紋 (Pedigree::fingerprint) を META キーに記録し、
+//             bloodline.csv が変わっていたら DB を作り直す
+//             (ID は読込順で決まるので、血統が変われば意味が変わる)
+//    ・差分取込 (pedigree_delta.h) では作り直さず、invalidate() で父母が変わった馬の
+//      子孫だけを消して版を新しい指紋に書き換える
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
+#include "ancestry.h"
+#include "approx_blood.h"
+#include "pedigree.h"
+
+class BloodStore {
+public:
+    static constexpr size_t BATCH_SIZE = 64 * 1024;     // 1 バッチの件数
+    static constexpr size_t BATCH_BYTES = 32u << 20;    // 祖先ベクトルは 1 件が大きいのでバイト数でも区切る
+    static constexpr size_t MAX_QUEUED = 64;            // 書込待ちバッチの既定の上限
+
+    static constexpr const char* ANCVEC_CF = "ancvec";
+    static constexpr const char* APPROX_CF = "approx";
+    static constexpr size_t COMPACT_AFTER_RANGES = 10'000;   // これ以上の範囲削除なら圧縮する
+
+    ~BloodStore() { close(); }
+
+    // version が DB 内の記録と違えば中身を捨てて作り直す
+    //  ancFloat = true なら祖先ベクトルの重みを float で保存 (サイズ半分、精度 7 桁)
+    void open(const std::string& path, std::uint64_t version, bool ancFloat = false) {
+        vecAsFloat = ancFloat;
+        rocksdb::Options op = options();
+        if (!tryOpen(op, path)) exit(1);
+
+        std::string stored;
+        const bool has = db->Get(rocksdb::ReadOptions(), metaKey(), &stored).ok();
+        if (has && stored.size() == 8 && decodeU64(stored.data()) == version) {
+            std::cout << "[db] " << path << " (version ok)\n";
+        }
+        else {
+            if (has) {
+                std::cout << "[db] 血統表が変わったためキャッシュを作り直します\n";
+                closeHandles();
+                rocksdb::DestroyDB(path, op);
+                if (!tryOpen(op, path)) exit(1);
+            }
+            char buf[8];  encodeU64(buf, version);
+            db->Put(rocksdb::WriteOptions(), metaKey(), rocksdb::Slice(buf, 8));
+        }
+        stopping = false;              // close() 後に開き直す場合 (ベンチマーク)
+        writer = std::thread([this] { writerLoop(); });
+    }
+
+    bool get(HorseId tgt, HorseId anc, double& v) {
+        char k[8];  encodeKey(k, tgt, anc);
+        std::string s;
+        if (!db->Get(readOpt, rocksdb::Slice(k, 8), &s).ok() || s.size() != sizeof(double))
+            return false;
+        std::memcpy(&v, s.data(), sizeof(double));
+        ++gets;
+        return true;
+    }
+
+    //---------------- 祖先ベクトル (ancvec 列ファミリ) ----------------
+    bool getAncestry(HorseId tgt, AncestryVec& v) {
+        char k[4];  encodeU32(k, tgt);
+        std::string s;
+        if (!db->Get(readOpt, cfVec, rocksdb::Slice(k, 4), &s).ok()) return false;
+        ++vecGets;
+        return decodeAncestry(s.data(), s.size(), v);
+    }
+
+    void putAncestry(HorseId tgt, const AncestryVec& v) {
+        char k[4];  encodeU32(k, tgt);
+        std::string s;
+        encodeAncestry(v, vecAsFloat, s);
+        ++vecPuts;  putBytes += 4 + s.size();
+        std::unique_lock<std::mutex> lk(mu);
+        cur.Put(cfVec, rocksdb::Slice(k, 4), s);
+        if ((size_t)cur.Count() >= BATCH_SIZE || cur.GetDataSize() >= BATCH_BYTES) handOff(lk);
+    }
+
+    //---------------- 近似の祖先ベクトル (approx 列ファミリ) ----------------
+    bool getApprox(HorseId tgt, const ApproxOptions& o, ApproxVec& a) {
+        char k[16];  encodeApproxKey(k, tgt, o);
+        std::string s;
+        if (!db->Get(readOpt, cfApprox, rocksdb::Slice(k, 16), &s).ok() || s.size() < sizeof(double)) return false;
+        std::memcpy(&a.bound, s.data(), sizeof(double));
+        ++vecGets;
+        return decodeAncestry(s.data() + sizeof(double), s.size() - sizeof(double), a.v);
+    }
+
+    void putApprox(HorseId tgt, const ApproxOptions& o, const ApproxVec& a) {
+        char k[16];  encodeApproxKey(k, tgt, o);
+        std::string s(reinterpret_cast<const char*>(&a.bound), sizeof(double)), body;
+        encodeAncestry(a.v, vecAsFloat, body);
+        s += body;
+        ++vecPuts;  putBytes += 16 + s.size();
+        std::unique_lock<std::mutex> lk(mu);
+        cur.Put(cfApprox, rocksdb::Slice(k, 16), s);
+        if ((size_t)cur.Count() >= BATCH_SIZE || cur.GetDataSize() >= BATCH_BYTES) handOff(lk);
+    }
+
+    void put(HorseId tgt, HorseId anc, double v) {
+        char k[8];  encodeKey(k, tgt, anc);
+        std::unique_lock<std::mutex> lk(mu);
+        cur.Put(rocksdb::Slice(k, 8), rocksdb::Slice(reinterpret_cast<const char*>(&v), sizeof(double)));
+        ++puts;  putBytes += 8 + sizeof(double);
+        if ((size_t)cur.Count() >= BATCH_SIZE) handOff(lk);
+    }
+
+    // 溜まっているバッチを全部書いてから memtable を flush
+    void flush() {
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            if (cur.Count()) handOff(lk);
+            cv.wait(lk, [&] { return queue.empty() && !writing; });
+        }
+        if (db) {
+            db->Flush(rocksdb::FlushOptions());
+            db->Flush(rocksdb::FlushOptions(), cfVec);
+            db->Flush(rocksdb::FlushOptions(), cfApprox);
+        }
+    }
+
+    //  tgts (ID 昇順) の保存値を全列ファミリから消し、版を version に書き換える。
+    //  連続する ID は 1 つの範囲削除にまとめ、削除と版の更新は 1 つの WriteBatch で書く
+    //  (途中で落ちても「古い版 + 古い値」のまま → 次回は作り直しになるだけ)
+    //  戻り値 = 範囲削除の数
+    size_t invalidate(const std::vector<HorseId>& tgts, std::uint64_t version) {
+        flush();
+        rocksdb::WriteBatch b;
+        size_t ranges = 0;
+        for (size_t i = 0; i < tgts.size(); ) {
+            size_t j = i + 1;
+            while (j < tgts.size() && tgts[j] == tgts[j - 1] + 1) ++j;
+            // [lo, hi) 。hi は最大でも NO_HORSE (= META の prefix) なので META は消えない
+            const HorseId lo = tgts[i], hi = tgts[j - 1] + 1;
+            char k0[8], k1[8];
+            encodeKey(k0, lo, 0);  encodeKey(k1, hi, 0);
+            b.DeleteRange(cfDefault, rocksdb::Slice(k0, 8), rocksdb::Slice(k1, 8));
+            b.DeleteRange(cfVec, rocksdb::Slice(k0, 4), rocksdb::Slice(k1, 4));
+            b.DeleteRange(cfApprox, rocksdb::Slice(k0, 4), rocksdb::Slice(k1, 4));
+            ++ranges;  i = j;
+        }
+        char v[8];  encodeU64(v, version);
+        b.Put(cfDefault, metaKey(), rocksdb::Slice(v, 8));
+        rocksdb::WriteOptions wo;
+        wo.sync = true;                // キャッシュ本体と違い、こちらは WAL 付きで確実に書く
+        auto st = db->Write(wo, &b);
+        if (!st.ok()) { std::cerr << st.ToString() << '\n';  return ranges; }
+
+        // 範囲削除の墓標が多いと読込が遅くなるので、まとめて片付ける
+        if (ranges >= COMPACT_AFTER_RANGES) {
+            rocksdb::CompactRangeOptions co;
+            db->CompactRange(co, cfDefault, nullptr, nullptr);
+            db->CompactRange(co, cfVec, nullptr, nullptr);
+            db->CompactRange(co, cfApprox, nullptr, nullptr);
+        }
+        return ranges;
+    }
+
+    void close() {
+        if (!db) return;
+        flush();
+        {
+            std::lock_guard<std::mutex> g(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (writer.joinable()) writer.join();
+        closeHandles();
+    }
+
+    //  書込待ちバッチの上限 (メモリ番人が逼迫時に絞る。0 は 1 とみなす)
+    void setMaxQueued(size_t n) { maxQueued = std::max<size_t>(1, n);  cv.notify_all(); }
+
+    std::uint64_t getCount() const { return gets; }
+    std::uint64_t putCount() const { return puts; }
+    std::uint64_t vecGetCount() const { return vecGets; }
+    std::uint64_t vecPutCount() const { return vecPuts; }
+    std::uint64_t putByteCount() const { return putBytes; }   // キー + 値 (全列ファミリ)
+    rocksdb::DB* raw() { return db.get(); }
+
+private:
+    static rocksdb::Options options() {
+        rocksdb::Options op;
+        op.create_if_missing = true;
+        op.compression = rocksdb::kNoCompression;
+        op.IncreaseParallelism();
+        op.OptimizeLevelStyleCompaction();
+
+        // tgt ごとの点検索が主なので、先頭 4B を prefix にしてブルームフィルタを張る
+        op.prefix_extractor.reset(rocksdb::NewFixedPrefixTransform(4));
+        op.memtable_prefix_bloom_size_ratio = 0.02;
+        rocksdb::BlockBasedTableOptions t;
+        t.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+        t.whole_key_filtering = true;
+        op.table_factory.reset(rocksdb::NewBlockBasedTableFactory(t));
+        return op;
+    }
+
+    // ancvec / approx は点検索だけなので prefix 抽出は不要
+    static rocksdb::ColumnFamilyOptions vecOptions() {
+        rocksdb::ColumnFamilyOptions co;
+        co.compression = rocksdb::kNoCompression;
+        co.OptimizeForPointLookup(64);
+        return co;
+    }
+
+    bool tryOpen(rocksdb::Options op, const std::string& path) {
+        op.create_missing_column_families = true;
+        std::vector<rocksdb::ColumnFamilyDescriptor> cfs = {
+            { rocksdb::kDefaultColumnFamilyName, op },
+            { ANCVEC_CF, vecOptions() },
+            { APPROX_CF, vecOptions() } };
+        std::vector<rocksdb::ColumnFamilyHandle*> hs;
+        rocksdb::DB* r = nullptr;
+        auto st = rocksdb::DB::Open(rocksdb::DBOptions(op), path, cfs, &hs, &r);
+        if (!st.ok()) { std::cerr << st.ToString() << '\n'; return false; }
+        db.reset(r);
+        cfDefault = hs[0];  cfVec = hs[1];  cfApprox = hs[2];
+        return true;
+    }
+
+    void closeHandles() {
+        if (!db) return;
+        db->DestroyColumnFamilyHandle(cfDefault);
+        db->DestroyColumnFamilyHandle(cfVec);
+        db->DestroyColumnFamilyHandle(cfApprox);
+        cfDefault = cfVec = cfApprox = nullptr;
+        db.reset();
+    }
+
+    // 呼び出し側で mu を保持していること。書込待ちが上限に達していれば空くまで待つ
+    // (書込が計算に追いつかないとき、バッチがメモリに溜まり続けないように)
+    void handOff(std::unique_lock<std::mutex>& lk) {
+        cv.wait(lk, [&] { return queue.size() < maxQueued.load(std::memory_order_relaxed) || stopping; });
+        queue.emplace_back(std::move(cur));
+        cur.Clear();
+        cv.notify_all();
+    }
+
+    void writerLoop() {
+        rocksdb::WriteOptions wo;
+        wo.disableWAL = true;          // キャッシュなので WAL は不要 (落ちても再計算で済む)
+        std::unique_lock<std::mutex> lk(mu);
+        for (;;) {
+            cv.wait(lk, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            rocksdb::WriteBatch b = std::move(queue.front());
+            queue.pop_front();
+            writing = true;
+            lk.unlock();
+            db->Write(wo, &b);
+            lk.lock();
+            writing = false;
+            cv.notify_all();
+        }
+    }
+
+    static void encodeU32(char* p, std::uint32_t x) {
+        p[0] = char(x >> 24); p[1] = char(x >> 16); p[2] = char(x >> 8); p[3] = char(x);
+    }
+    static void encodeKey(char* p, HorseId tgt, HorseId anc) { encodeU32(p, tgt); encodeU32(p + 4, anc); }
+    static void encodeU64(char* p, std::uint64_t x) { encodeU32(p, std::uint32_t(x >> 32)); encodeU32(p + 4, std::uint32_t(x)); }
+    static void encodeApproxKey(char* p, HorseId tgt, const ApproxOptions& o) {
+        std::uint64_t bits;  std::memcpy(&bits, &o.minWeight, sizeof bits);
+        encodeU32(p, tgt);  encodeU32(p + 4, o.maxDepth);  encodeU64(p + 8, bits);
+    }
+    static std::uint64_t decodeU64(const char* p) {
+        std::uint64_t x = 0;
+        for (int i = 0; i < 8; ++i) x = (x << 8) | std::uint8_t(p[i]);
+        return x;
+    }
+    // tgt = 0xFFFFFFFF (NO_HORSE) は実データに現れないので META に使う
+    static rocksdb::Slice metaKey() { return rocksdb::Slice("\xFF\xFF\xFF\xFFver", 7); }
+
+    std::unique_ptr<rocksdb::DB> db;
+    rocksdb::ColumnFamilyHandle* cfDefault = nullptr;
+    rocksdb::ColumnFamilyHandle* cfVec = nullptr;
+    rocksdb::ColumnFamilyHandle* cfApprox = nullptr;
+    rocksdb::ReadOptions readOpt;
+    bool vecAsFloat = false;
+
+    std::mutex mu;
+    std::condition_variable cv;
+    rocksdb::WriteBatch cur;
+    std::deque<rocksdb::WriteBatch> queue;
+    std::thread writer;
+    bool writing = false, stopping = false;
+    std::atomic<size_t> maxQueued{ MAX_QUEUED };
+
+    std::atomic<std::uint64_t> gets{ 0 }, puts{ 0 }, vecGets{ 0 }, vecPuts{ 0 }, putBytes{ 0 };
+};
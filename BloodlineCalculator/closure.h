@@ -0,0 +1,148 @@
+﻿#pragma once
+//====================================================================
+//  closure.h  ―― 祖先・子孫の閉包 (ID のビット集合)
+//
+//    ・HorseSet : 1 頭 1 bit の集合。所属判定 count() は O(1) で分岐もほぼ無い
+//                 (行列出力のセルごとの判定向け)。和 |= / 積 &= / 差 -= は 64 頭ずつの語演算。
+//                 範囲 for は ID 昇順。300 万頭でも 375 KB
+//    ・ancestorsOf / descendantsOf : 複数の起点から 1 回の走査で閉包を作る
+//        - 再帰ではなく明示スタック (深い血統でもスタックあふれしない)
+//        - 印の付いた馬は展開しないので、循環があっても各馬 1 回で止まる
+//        - 起点そのものは入れない (他の起点から届いた場合は入る)。
+//          起点ごとに集めた和集合と同じ
+//        - out に足していく。out は空か、同じ向きの閉包であること
+//====================================================================
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "pedigree.h"
+
+namespace closure {
+
+inline unsigned lowestBit(std::uint64_t w) {
+#if defined(_MSC_VER)
+    unsigned long i;  _BitScanForward64(&i, w);
+    return unsigned(i);
+#else
+    return unsigned(__builtin_ctzll(w));
+#endif
+}
+
+inline size_t popCount(std::uint64_t w) {
+#if defined(_MSC_VER)
+    return size_t(__popcnt64(w));
+#else
+    return size_t(__builtin_popcountll(w));
+#endif
+}
+
+} // namespace closure
+
+class HorseSet {
+public:
+    HorseSet() = default;
+    explicit HorseSet(size_t n) { reset(n); }
+
+    //  n 頭ぶんの空集合にする
+    void reset(size_t n) { universe = n;  words.assign((n + 63) / 64, 0); }
+    size_t capacity() const { return universe; }
+
+    bool count(HorseId id) const { return id < universe && (words[id >> 6] >> (id & 63)) & 1; }
+    bool insert(HorseId id) {
+        std::uint64_t& w = words[id >> 6];
+        const std::uint64_t b = std::uint64_t(1) << (id & 63);
+        if (w & b) return false;
+        w |= b;
+        return true;
+    }
+    void erase(HorseId id) { if (id < universe) words[id >> 6] &= ~(std::uint64_t(1) << (id & 63)); }
+
+    size_t size() const {
+        size_t s = 0;
+        for (std::uint64_t w : words) s += closure::popCount(w);
+        return s;
+    }
+    bool empty() const {
+        for (std::uint64_t w : words) if (w) return false;
+        return true;
+    }
+
+    //  全頭を入れる (補集合 = fill してから -=)
+    void fill() {
+        std::fill(words.begin(), words.end(), ~std::uint64_t(0));
+        if (universe & 63) words.back() = (std::uint64_t(1) << (universe & 63)) - 1;
+    }
+
+    //  和・積・差 (同じ頭数の集合どうし)
+    HorseSet& operator|=(const HorseSet& o) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] |= o.words[i];
+        return *this;
+    }
+    HorseSet& operator&=(const HorseSet& o) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] &= o.words[i];
+        return *this;
+    }
+    HorseSet& operator-=(const HorseSet& o) {
+        for (size_t i = 0; i < words.size(); ++i) words[i] &= ~o.words[i];
+        return *this;
+    }
+
+    //---------------- ID 昇順の走査 ----------------
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = HorseId;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const HorseId*;
+        using reference = HorseId;
+
+        const_iterator(const std::vector<std::uint64_t>* w, size_t i) : words(w), wi(i) { settle(); }
+        HorseId operator*() const { return HorseId(wi * 64 + closure::lowestBit(cur)); }
+        const_iterator& operator++() { cur &= cur - 1;  if (!cur) { ++wi;  settle(); }  return *this; }
+        const_iterator operator++(int) { const_iterator t = *this;  ++*this;  return t; }
+        bool operator==(const const_iterator& o) const { return wi == o.wi && cur == o.cur; }
+        bool operator!=(const const_iterator& o) const { return !(*this == o); }
+    private:
+        void settle() {       // 次に 1 のある語まで進む
+            while (wi < words->size() && !(*words)[wi]) ++wi;
+            cur = wi < words->size() ? (*words)[wi] : 0;
+        }
+        const std::vector<std::uint64_t>* words;
+        size_t wi;
+        std::uint64_t cur = 0;
+    };
+    const_iterator begin() const { return const_iterator(&words, 0); }
+    const_iterator end() const { return const_iterator(&words, words.size()); }
+
+private:
+    size_t universe = 0;
+    std::vector<std::uint64_t> words;
+};
+
+//  seeds の祖先 (父母を何代でもさかのぼる) を out に足す
+inline void ancestorsOf(const Pedigree& ped, const std::vector<HorseId>& seeds, HorseSet& out) {
+    if (out.capacity() != ped.size()) out.reset(ped.size());
+    std::vector<HorseId> stack;
+    for (HorseId s : seeds) if (s != NO_HORSE) stack.push_back(s);
+    while (!stack.empty()) {
+        const HorseId h = stack.back();  stack.pop_back();
+        for (HorseId p : { ped.sire[h], ped.dam[h] })
+            if (p != NO_HORSE && out.insert(p)) stack.push_back(p);
+    }
+}
+
+//  seeds の子孫 (子を何代でもたどる) を out に足す
+inline void descendantsOf(const Pedigree& ped, const std::vector<HorseId>& seeds, HorseSet& out) {
+    if (out.capacity() != ped.size()) out.reset(ped.size());
+    std::vector<HorseId> stack;
+    for (HorseId s : seeds) if (s != NO_HORSE) stack.push_back(s);
+    while (!stack.empty()) {
+        const HorseId h = stack.back();  stack.pop_back();
+        for (const HorseId* c = ped.childrenBegin(h); c != ped.childrenEnd(h); ++c)
+            if (out.insert(*c)) stack.push_back(*c);
+    }
+}
@@ -0,0 +1,164 @@
+﻿#pragma once
+//====================================================================
+//  csv_loader.h  ―― bloodline.csv の読込 (mmap + string_view + 並列)
+//
+//    ・ファイルを丸ごとメモリマップし、必要な列だけ string_view で切り出す
+//      (引用符を含む列だけは引用符を外したコピーを作る)
+//    ・大きいファイルは行境界でスレッド数ぶんに分割して並列に解析
+//    ・解析結果はファイル順に Pedigree へ登録 (ID は従来と同じ読込順)
+//    列: 0=PrimaryKey 1=Sire 2=Dam 3=Sex 5=Year 8=Horse Name (9 列未満の行は捨てる)
+//====================================================================
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "mapped_file.h"
+#include "pedigree.h"
+
+struct CsvLoadStats {
+    size_t rows = 0;       // 取り込んだ行
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+namespace csvload {
+
+struct Row { std::string_view pk, sire, dam, sex, year, name; };
+
+struct Chunk {
+    std::vector<Row> rows;
+    std::deque<std::string> owned;    // 引用符を外したコピー (string_view の実体)
+};
+
+// std::stoi 相当 (先頭空白・符号可、数字が無い / 桁あふれは INT_MIN)
+inline int parseYear(std::string_view y) {
+    size_t i = 0;
+    while (i < y.size() && (y[i] == ' ' || (y[i] >= '\t' && y[i] <= '\r'))) ++i;
+    bool neg = false;
+    if (i < y.size() && (y[i] == '+' || y[i] == '-')) neg = (y[i++] == '-');
+    long long v = 0;  size_t d = 0;
+    for (; i < y.size() && y[i] >= '0' && y[i] <= '9'; ++i, ++d) {
+        v = v * 10 + (y[i] - '0');
+        if (v > (long long)INT_MAX + 1) return INT_MIN;
+    }
+    if (!d) return INT_MIN;
+    v = neg ? -v : v;
+    return (v < INT_MIN || v > INT_MAX) ? INT_MIN : int(v);
+}
+
+//  1 行を解析。従来の splitCSV と同じく '"' は開閉を切り替えて捨てる
+inline bool parseLine(const char* b, const char* e, Row& r, std::deque<std::string>& owned) {
+    std::string_view* want[9] = { &r.pk, &r.sire, &r.dam, &r.sex, nullptr, &r.year, nullptr, nullptr, &r.name };
+    int field = 0;
+    const char* fs = b;
+    bool inq = false, quoted = false;
+    auto finish = [&](const char* fe) {
+        if (field < 9 && want[field]) {
+            if (!quoted) *want[field] = std::string_view(fs, size_t(fe - fs));
+            else {
+                owned.emplace_back();
+                for (const char* p = fs; p < fe; ++p) if (*p != '"') owned.back().push_back(*p);
+                *want[field] = owned.back();
+            }
+        }
+        ++field;
+    };
+    for (const char* p = b; p < e; ++p) {
+        if (*p == '"') { inq = !inq; quoted = true; }
+        else if (*p == ',' && !inq) { finish(p); fs = p + 1; quoted = false; }
+    }
+    finish(e);
+    return field >= 9;
+}
+
+inline void parseRange(const char* b, const char* e, Chunk& out) {
+    while (b < e) {
+        const char* nl = static_cast<const char*>(std::memchr(b, '\n', size_t(e - b)));
+        const char* le = nl ? nl : e;
+        Row r;
+        if (le != b && parseLine(b, le, r, out.owned)) out.rows.push_back(r);
+        b = nl ? nl + 1 : e;
+    }
+}
+
+} // namespace csvload
+
+//  path を読み込んで ped を作る (buildChildren / buildTopoOrder / buildYearOrder まで)
+inline bool loadPedigreeCSV(const std::string& path, Pedigree& ped, unsigned threads,
+    CsvLoadStats& st)
+{
+    using namespace csvload;
+    auto t0 = std::chrono::steady_clock::now();
+    MappedFile mf;
+    if (!mf.open(path)) return false;
+    const char* b = mf.data();
+    const char* e = b + mf.size();
+
+    // ヘッダ行を飛ばす
+    const char* nl = static_cast<const char*>(std::memchr(b, '\n', mf.size()));
+    b = nl ? nl + 1 : e;
+
+    // 行境界で分割 (小さいファイルは 1 本で十分)
+    constexpr size_t MIN_CHUNK = 4 << 20;
+    size_t parts = std::max<size_t>(1, std::min<size_t>(threads, size_t(e - b) / MIN_CHUNK));
+    std::vector<const char*> cut{ b };
+    for (size_t i = 1; i < parts; ++i) {
+        const char* p = b + size_t(e - b) * i / parts;
+        if (p < cut.back()) p = cut.back();
+        const char* q = static_cast<const char*>(std::memchr(p, '\n', size_t(e - p)));
+        cut.push_back(q ? q + 1 : e);
+    }
+    cut.push_back(e);
+
+    std::vector<Chunk> chunks(parts);
+    std::vector<std::thread> th;
+    for (size_t i = 1; i < parts; ++i)
+        th.emplace_back([&, i] { parseRange(cut[i], cut[i + 1], chunks[i]); });
+    parseRange(cut[0], cut[1], chunks[0]);
+    for (auto& t : th) t.join();
+
+    // ファイル順に登録 (重複した PrimaryKey は後の行で上書き)
+    size_t rowsTotal = 0;
+    for (auto& c : chunks) rowsTotal += c.rows.size();
+    ped.idOf.reserve(rowsTotal);
+    std::vector<std::pair<std::string_view, std::string_view>> parentPk;   // ID → (父, 母)
+    parentPk.reserve(rowsTotal);
+    std::string pk;
+    for (auto& c : chunks) {
+        for (const Row& r : c.rows) {
+            pk.assign(r.pk.data(), r.pk.size());
+            HorseId id = ped.intern(pk);
+            if (id == parentPk.size()) parentPk.emplace_back();
+            parentPk[id] = { r.sire, r.dam };
+            ped.yearStr[id].assign(r.year.data(), r.year.size());
+            ped.year[id] = parseYear(r.year);
+            ped.name[id].assign(r.name.data(), r.name.size());
+            ped.sex[id].assign(r.sex.data(), r.sex.size());
+            std::string& d = ped.display[id];
+            d.clear();  d.reserve(r.name.size() + r.year.size() + 3);
+            d.append(r.name.data(), r.name.size()).append(" [").append(r.year.data(), r.year.size()).append("]");
+        }
+    }
+
+    // 親を ID に解決 (CSV 中で子が親より先に出ても OK)
+    for (HorseId id = 0; id < ped.size(); ++id) {
+        const auto& sp = parentPk[id];
+        pk = sp.first.empty() ? UNKNOWN_SIRE : std::string(sp.first);
+        ped.sire[id] = ped.find(pk);                    // 未登録の親は NO_HORSE
+        pk = sp.second.empty() ? UNKNOWN_DAM : std::string(sp.second);
+        ped.dam[id] = ped.find(pk);
+    }
+    ped.buildChildren();
+    ped.buildTopoOrder();
+    ped.buildYearOrder();
+
+    st.rows = rowsTotal;
+    st.bytes = mf.size();
+    st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
@@ -1,127 +0,0 @@
-#include <iostream>
-#include <unordered_map>
-#include <vector>
-#include <fstream>
-#include <sstream>
-#include <cuda_runtime.h>
-
-using namespace std;
-
-// ňf[^i[\
-struct Horse {
-    string PrimaryKey;
-    string Sire; // 
-    string Dam;  // 
-};
-
-// f[^iCPUj
-unordered_map<string, Horse> horses;
-vector<string> horseNames;
-vector<double> bloodCache;
-
-// GPUp|C^
-double* d_bloodCache;
-
-// CSVt@C猌f[^ǂݍ
-void loadCSV(const string& filename) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "G[: t@C " << filename << " J܂łB" << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    string line;
-    getline(file, line); // wb_[XLbv
-
-    while (getline(file, line)) {
-        stringstream ss(line);
-        string PrimaryKey, Sire, Dam;
-        getline(ss, PrimaryKey, ',');
-        getline(ss, Sire, ',');
-        getline(ss, Dam, ',');
-
-        horses[PrimaryKey] = { PrimaryKey, Sire, Dam };
-        horseNames.push_back(PrimaryKey);
-    }
-    file.close();
-    cout << "f[^ǂݍ݊Bn̐: " << horses.size() << endl;
-}
-
-// GPUJ[livZj
-__global__ void computeBloodPercentageKernel(double* d_bloodCache, int numHorses) {
-    int i = blockIdx.x * blockDim.x + threadIdx.x;
-    if (i < numHorses) {
-        for (int j = 0; j < numHorses; ++j) {
-            // GPUŌʌvZiVvȗj
-            d_bloodCache[i * numHorses + j] = (i == j) ? 1.0 : 0.5; // ̒l
-        }
-    }
-}
-
-// GPUŌʌvZs
-void computeBloodPercentageGPU(int numHorses) {
-    size_t size = numHorses * numHorses * sizeof(double);
-
-    // GPUm
-    cudaMalloc((void**)&d_bloodCache, size);
-    cudaMemset(d_bloodCache, 0, size);
-
-    // CUDAJ[ls
-    int threadsPerBlock = 256;
-    int blocksPerGrid = (numHorses + threadsPerBlock - 1) / threadsPerBlock;
-    computeBloodPercentageKernel << <blocksPerGrid, threadsPerBlock >> > (d_bloodCache, numHorses);
-
-    // vZʂ擾
-    cudaMemcpy(bloodCache.data(), d_bloodCache, size, cudaMemcpyDeviceToHost);
-
-    // GPU
-    cudaFree(d_bloodCache);
-}
-
-// CSVt@CɌʃf[^o
-void saveCSV(const string& filename, int numHorses) {
-    ofstream file(filename);
-    if (!file.is_open()) {
-        cerr << "G[: t@C " << filename << " J܂łB" << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    // wb_[
-    file << ",";
-    for (const auto& name : horseNames) {
-        file << name << ",";
-    }
-    file << "\n";
-
-    // eňʃf[^
-    for (int i = 0; i < numHorses; ++i) {
-        file << horseNames[i] << ",";
-        for (int j = 0; j < numHorses; ++j) {
-            file << bloodCache[i * numHorses + j] << ",";
-        }
-        file << "\n";
-    }
-
-    file.close();
-    cout << "ʃf[^ " << filename << " ɕۑ܂B" << endl;
-}
-
-int main() {
-    string inputFile = "bloodline.csv";  // ̓t@C
-    string outputFile = "blood_percentage.csv"; // o̓t@C
-
-    cout << "CSVf[^[hJn..." << endl;
-    loadCSV(inputFile);
-    int numHorses = horseNames.size();
-    bloodCache.resize(numHorses * numHorses);
-
-    cout << "GPUŌʌvZJn..." << endl;
-    computeBloodPercentageGPU(numHorses);
-    cout << "GPUł̌ʌvZI" << endl;
-
-    cout << "vZʂCSVɕۑ..." << endl;
-    saveCSV(outputFile, numHorses);
-
-    cout << "ʌvZBʂ " << outputFile << " ɕۑ܂B" << endl;
-    return 0;
-}
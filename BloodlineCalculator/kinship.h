@@ -0,0 +1,142 @@
+﻿#pragma once
+//====================================================================
+//  kinship.h  ―― 近交係数 (Wright の F) と 2 頭間の血縁係数 (kinship)
+//
+//    相加的血縁行列 A = L D L'
+//      L[x][j] = 馬 j の血が x に入る割合 (= ancestry.h の祖先ベクトル, L[x][x] = 1)
+//      D[j]    = メンデルのサンプリング分散
+//                両親既知 0.5 - (F父 + F母)/4, 片親 0.75 - F親/4, 両親不明 1
+//    ・F(x)       = Σ_j L[x][j]² D[j] - 1          (Meuwissen & Luo 1992)
+//        世代順に 1 世代ずつ、同じ世代の馬は並列に求める。F は両親だけで決まるので
+//        全兄弟 (父母が同じ組) は 1 回だけ計算する
+//    ・kinship(x,y) = ½ Σ_j L[x][j] L[y][j] D[j]   (祖先ベクトル 2 本の疎な内積)
+//        関係行列全体は作らない。x 側を密な作業領域に散らし、y 側 (D を掛け済み) を舐める
+//    ・産駒の近交係数 = 父と母の kinship
+//    ※ ped.acyclic == true が前提
+//====================================================================
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ancestry.h"
+#include "parallel.h"
+#include "pedigree.h"
+
+struct KinshipStats {
+    size_t horses = 0, families = 0, generations = 0;   // families = 計算した父母の組
+    double maxF = 0, meanF = 0;
+    double seconds = 0;
+};
+
+class KinshipEngine {
+public:
+    explicit KinshipEngine(const Pedigree& p) : ped(p) {}
+
+    //  全馬の F と D (Meuwissen & Luo)
+    void computeInbreeding(unsigned threads, KinshipStats* st = nullptr) {
+        auto t0 = std::chrono::steady_clock::now();
+        const size_t n = ped.size();
+        F.assign(n, 0.0);
+        D.assign(n, 1.0);
+        std::vector<std::uint32_t> gen;
+        const std::vector<HorseId> order = generationOrder(ped, &gen);
+
+        WorkStealingPool pool(threads);
+        std::vector<Work> work(pool.size());
+        size_t families = 0, levels = 0;
+
+        for (size_t b = 0; b < order.size(); ) {
+            size_t e = b;
+            while (e < order.size() && gen[order[e]] == gen[order[b]]) ++e;
+            ++levels;
+
+            // D は前の世代の F だけで決まる
+            for (size_t i = b; i < e; ++i) D[order[i]] = mendelian(order[i]);
+
+            // 父母の組ごとに代表 1 頭 (両親既知のみ。片親以下は F = 0)
+            std::unordered_map<std::uint64_t, std::vector<HorseId>> fam;
+            std::vector<std::uint64_t> keys;
+            for (size_t i = b; i < e; ++i) {
+                const HorseId h = order[i];
+                if (ped.sire[h] == NO_HORSE || ped.dam[h] == NO_HORSE) continue;
+                const std::uint64_t k = (std::uint64_t(ped.sire[h]) << 32) | ped.dam[h];
+                auto& v = fam[k];
+                if (v.empty()) keys.push_back(k);
+                v.push_back(h);
+            }
+            families += keys.size();
+
+            pool.run(keys.size(), [&](size_t t, unsigned w) {
+                const std::vector<HorseId>& sibs = fam.find(keys[t])->second;
+                const double a = selfRelationship(sibs[0], work[w]);
+                for (HorseId h : sibs) F[h] = a - 1.0;
+            });
+            b = e;
+        }
+
+        if (st) {
+            st->horses = n;  st->families = families;  st->generations = levels;
+            st->maxF = 0;  double sum = 0;
+            for (double f : F) { st->maxF = std::max(st->maxF, f);  sum += f; }
+            st->meanF = n ? sum / n : 0.0;
+            st->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+    }
+
+    const std::vector<double>& inbreeding() const { return F; }
+
+    //  列側の前処理: 祖先ベクトルの重みに D を掛ける (computeInbreeding の後)
+    void weightByD(AncestryVec& v) const { for (auto& e : v) e.second *= D[e.first]; }
+
+    //  kinship(x, y)。dense = x の祖先ベクトルを散らした作業領域 (他は 0),
+    //  wy = y の祖先ベクトルに weightByD を掛けたもの
+    static double kinship(const std::vector<double>& dense, const AncestryVec& wy) {
+        double a = 0.0;
+        for (const auto& e : wy) a += dense[e.first] * e.second;
+        return 0.5 * a;
+    }
+
+private:
+    struct Work {
+        std::vector<double>  weight;     // ID → L[x][j] (使った所だけ戻す)
+        std::vector<HorseId> touched;
+    };
+
+    //  a_xx = Σ_j L[x][j]² D[j]。祖先を topo 位置の降順にたどり、重みを親へ半分ずつ送る
+    //  (ancestry.h の逆向き伝播と同じ手順。ベクトルは作らず、その場で足し込む)
+    double selfRelationship(HorseId x, Work& wk) const {
+        if (wk.weight.empty()) wk.weight.assign(ped.size(), 0.0);
+        std::vector<double>& w = wk.weight;
+        std::vector<HorseId>& t = wk.touched;
+        t.assign(1, x);  w[x] = -1.0;
+        for (size_t i = 0; i < t.size(); ++i)
+            for (HorseId p : { ped.sire[t[i]], ped.dam[t[i]] })
+                if (p != NO_HORSE && w[p] == 0.0) { w[p] = -1.0;  t.push_back(p); }
+        for (HorseId h : t) w[h] = 0.0;
+        std::sort(t.begin(), t.end(), [&](HorseId a, HorseId b) { return ped.topoPos[a] > ped.topoPos[b]; });
+
+        w[x] = 1.0;
+        double a = 0.0;
+        for (HorseId h : t) {
+            const double l = w[h];
+            a += l * l * D[h];
+            if (ped.sire[h] != NO_HORSE) w[ped.sire[h]] += 0.5 * l;
+            if (ped.dam[h] != NO_HORSE)  w[ped.dam[h]] += 0.5 * l;
+            w[h] = 0.0;
+        }
+        return a;
+    }
+
+    double mendelian(HorseId h) const {
+        const HorseId s = ped.sire[h], d = ped.dam[h];
+        if (s != NO_HORSE && d != NO_HORSE) return 0.5 - 0.25 * (F[s] + F[d]);
+        if (s != NO_HORSE) return 0.75 - 0.25 * F[s];
+        if (d != NO_HORSE) return 0.75 - 0.25 * F[d];
+        return 1.0;
+    }
+
+    const Pedigree& ped;
+    std::vector<double> F, D;
+};
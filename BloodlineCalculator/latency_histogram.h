@@ -0,0 +1,62 @@
+﻿#pragma once
+//====================================================================
+//  latency_histogram.h  ―― ロックフリーの対数バケット遅延ヒストグラム
+//
+//    ns 単位。2 の冪ごとに 4 分割したバケット (相対誤差 ≦ 25%) に数えるだけなので
+//    複数スレッドから同時に record() してよい。percentile() はバケット上端を返す
+//====================================================================
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB = 4;                 // 2 の冪あたりの分割数
+    static constexpr size_t BUCKETS = 64 * SUB;
+
+    void record(std::uint64_t ns) {
+        counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        n.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        std::uint64_t m = mx.load(std::memory_order_relaxed);
+        while (ns > m && !mx.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+    }
+
+    std::uint64_t count() const { return n.load(std::memory_order_relaxed); }
+    std::uint64_t maxNs() const { return mx.load(std::memory_order_relaxed); }
+    double        meanNs() const { auto c = count(); return c ? double(sum.load()) / c : 0.0; }
+
+    // q ∈ [0,1] の分位点 (ns, バケット上端。max を超えない)
+    std::uint64_t percentile(double q) const {
+        const std::uint64_t total = count();
+        if (!total) return 0;
+        std::uint64_t rank = std::uint64_t(q * total), seen = 0;
+        if (rank >= total) rank = total - 1;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += counts[b].load(std::memory_order_relaxed);
+            if (seen > rank) { auto u = upperOf(b);  return u < maxNs() ? u : maxNs(); }
+        }
+        return maxNs();
+    }
+
+    void reset() {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+        n = 0;  sum = 0;  mx = 0;
+    }
+
+private:
+    static size_t bucketOf(std::uint64_t ns) {
+        if (ns < SUB) return size_t(ns);
+        unsigned msb = 0;
+        for (std::uint64_t x = ns; x >>= 1; ) ++msb;
+        return msb * SUB + size_t((ns >> (msb - 2)) & (SUB - 1));
+    }
+    static std::uint64_t upperOf(size_t b) {
+        if (b < SUB) return b + 1;
+        const unsigned msb = unsigned(b / SUB);
+        return ((SUB | (b % SUB)) + 1) << (msb - 2);
+    }
+
+    std::array<std::atomic<std::uint64_t>, BUCKETS> counts{};
+    std::atomic<std::uint64_t> n{ 0 }, sum{ 0 }, mx{ 0 };
+};
@@ -18,21 +18,49 @@
 #include <algorithm>
 #include <climits>
 #include <cmath>
-#define NOMINMAX    // これを windows.h より前に置く
-#include <windows.h>
-#include <psapi.h>
-
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #ifdef _WIN32
+#define NOMINMAX    // これを windows.h より前に置く
+#define WIN32_LEAN_AND_MEAN   // winsock2.h (query_server.h) と衝突させない
 #include <windows.h>
 #include <psapi.h>
 #else
 #include <sys/resource.h>
 #include <unistd.h>
 #endif
-#include <rocksdb/db.h>
-#include <rocksdb/options.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "pedigree.h"
+#include "csv_loader.h"
+#include "snapshot.h"
+#include "output_writer.h"
+#include "matrix_format.h"
+#include "propagate.h"
+#include "ancestry.h"
+#include "parallel.h"
+#include "blood_cache.h"
+#include "blood_store.h"
+#include "batch_plan.h"
+#include "query_server.h"
+#include "topk.h"
+#include "run_report.h"
+#include "allpairs.h"
+#include "kinship.h"
+#include "pedigree_delta.h"
+#include "closure.h"
+#include "approx_blood.h"
+#include "memory_governor.h"
+#include "target_index.h"
+#include "shard.h"
 // --------------- 追加ヘッダ ----------------
 #include <regex>
+#include <filesystem>
+#include <cstdio>
 
 // --------------- 追加 util -----------------
 static inline std::string trim(std::string s) {
@@ -41,33 +69,61 @@ static inline std::string trim(std::string s) {
     return (b == std::string::npos) ? "" : s.substr(b, e - b + 1);
 }
 
-std::unique_ptr<rocksdb::DB> db;          // メモ化キャッシュ本体
-constexpr const char* DBPATH = "D:/AI/C++/blood_cache_db";
+BloodStore store;                         // メモ化キャッシュ本体 (RocksDB)
 
 //------------------------- 基本定数 -------------------------------
-static const std::string UNKNOWN_SIRE = "UNKNOWN_SIRE";
-static const std::string UNKNOWN_DAM = "UNKNOWN_DAM";
 static const size_t MEMORY_THRESHOLD_MB = 10'000;   // 10 GB で警告
+static const size_t SWEEP_LIMIT_MB = 4'000;         // 前進スイープの結果表の上限
 
-//------------------------- 構造体 -------------------------------
-struct Horse {
-    std::string PrimaryKey;
-    std::string HorseName;
-    std::string YearStr;
-    int         YearInt;
-    std::string Sire;
-    std::string Dam;
+//------------------------- 実行時設定 -------------------------------
+struct RunConfig {
+    unsigned threads = 1;           // --threads N : 行列出力の並列数
+    size_t   cacheMB = 64;          // --cache-mb N : メモリ内血量キャッシュの容量
+    size_t   memBudgetMB = 0;       // --mem-budget N : 使用メモリの予算 (0 = 無効)
+    std::string dbPath = "D:/AI/C++/blood_cache_db";   // --db PATH
+    bool     ancFloat = false;      // --ancvec-float : 祖先ベクトルを float で保存
+    bool     compile = false;       // --compile : スナップショットを作って終了
+    std::string snapshotPath = "bloodline.snap";       // --snapshot PATH
+    unsigned progressMs = 1000;     // --progress-ms N : 進捗ログの間隔
+    bool     quiet = false;         // --quiet : 進捗ログを出さない
+    MatrixFormat format = MatrixFormat::CSV;           // --format csv|triplet|npy|bin|sbin
+    bool     f32 = false;           // --dtype f32 : バイナリ出力を float32 で
+    bool     gzip = false;          // --gzip : 出力を gzip で圧縮
+    std::string outDir = "D:/AI/C++/out";              // --out DIR : 出力先
+    std::string batchPath;          // --batch FILE : ジョブファイルを一括実行
+    std::string servePath;          // --serve PATH : Unix ソケットで常駐サーバ
+    size_t   topK = 0;              // --top K : 行列の代わりに上位 K 頭だけを出力
+    TopKFilter topFilter;           // --top-year / --top-sex : 上位 K 頭の絞り込み
+    bool     report = false;        // --report : 実行の計測結果を JSON で出力先に書く
+    bool     allPairs = false;      // --all-pairs : 全馬 × 全馬の血量行列を出力
+    bool     inbreeding = false;    // --inbreeding : 全馬の近交係数を出力
+    std::string kinRows, kinCols;   // --kinship Q / --kin-with Q : 交配の組の kinship 行列
+    std::string kinRowSex, kinColSex;  // --kin-sex R,C : 行 / 列の Sex で絞る
+    std::string deltaPath;          // --delta FILE : 追加・訂正を取り込み、影響する保存値だけ消す
+    ApproxOptions approx;           // --max-depth D / --min-contrib W : 近似モード
+    unsigned shards = 0;            // --shards N : N 個のワーカープロセスで分担して統合
+    ShardSpec shard;                // --shard I/N : ワーカーとして I 番目の分担だけを計算
+    std::vector<std::string> args;  // ワーカーに渡す引数 (実行ファイル + --shards 以外の全部)
 };
+RunConfig cfg;
+RunReport report;                   // 工程ごとの時間・キャッシュ段ごとの件数・最大メモリ
 
 //------------------------- 大域データ -------------------------------
-std::unordered_map<std::string, Horse> horses;        // PK → 馬
-std::unordered_map<std::string, std::string> keyToDisplayName;
-std::unordered_map<std::string,
-    std::unordered_map<std::string, double>> dp; // メモ化
-std::unordered_map<std::string, std::vector<std::string>> childrenOf; // 親→子
+Pedigree ped;                                         // ID 化した血統表
+TargetIndex targetIndex;                              // 対象馬の選択用の索引 (読込後に作る)
 
 //------------------------- ユーティリティ -------------------------------
+//  今の常駐メモリ (MB)。Linux は /proc/self/statm の RSS (ru_maxrss は最大値なので、
+//  メモリ番人が「減ったか」を見られない)。mac は最大値で代用
 size_t getMemoryUsageMB() {
+#if defined(__linux__)
+    if (FILE* f = std::fopen("/proc/self/statm", "r")) {
+        unsigned long long pages = 0, resident = 0;
+        const int got = std::fscanf(f, "%llu %llu", &pages, &resident);
+        std::fclose(f);
+        if (got == 2) return size_t(resident * (unsigned long long)sysconf(_SC_PAGESIZE) / (1024 * 1024));
+    }
+#endif
 #ifdef _WIN32
     PROCESS_MEMORY_COUNTERS_EX pmc;
     if (GetProcessMemoryInfo(GetCurrentProcess(),
@@ -81,131 +137,466 @@ size_t getMemoryUsageMB() {
 #endif
     return 0;
 }
-int parseYearInt(const std::string& y) {
-    if (y.empty()) return INT_MIN;
-    try { return std::stoi(y); }
-    catch (...) { return INT_MIN; }
+BloodCache lru(64);                // 容量は main で cfg.cacheMB に合わせ直す
+SharedWork shared;                 // バッチ実行時、グループ内で共有する計算結果
+ApproxStats approxStats;           // 近似モードで使った値の誤差上限 (クエリごと)
+
+//------------------------- メモリ番人 -------------------------------
+//  --mem-budget の予算に合わせてキャッシュ段を伸縮する (番人のスレッドから呼ばれる)
+//    HIGH     : LRU を半分に、RocksDB の書込待ちを 2 バッチまで
+//    CRITICAL : LRU を最小にして中身も捨て、書込待ちを 1 バッチまで
+//    NORMAL   : 書込待ちを戻し、余裕があれば LRU を倍ずつ cfg.cacheMB まで戻す
+MemoryGovernor governor;
+static const size_t MIN_CACHE_MB = 4;
+
+void trimHeap() {
+#if defined(__GLIBC__)
+    malloc_trim(0);                 // 解放済みの領域を OS に返す
+#endif
 }
-std::vector<std::string> splitCSV(const std::string& line) {
-    std::vector<std::string> out;  bool inq = false;  std::string buf;
-    for (char c : line) {
-        if (c == '"') { inq = !inq; }
-        else if (c == ',' && !inq) { out.push_back(buf); buf.clear(); }
-        else buf.push_back(c);
+
+void adaptToMemory(MemoryGovernor::Level lv, size_t) {
+    const size_t cap = lru.capacityMB();
+    if (lv == MemoryGovernor::CRITICAL) {
+        store.setMaxQueued(1);
+        if (cap > MIN_CACHE_MB) { lru.clear();  lru.resize(MIN_CACHE_MB);  report.add("governor_cache_shrinks", 1); }
+        trimHeap();
     }
-    out.push_back(buf); return out;
-}
-void openDB()
-{
-    rocksdb::Options op;
-    op.create_if_missing = true;
-    op.compression = rocksdb::kNoCompression;   // ← これに変更
-
-    op.IncreaseParallelism();
-    op.OptimizeLevelStyleCompaction();
-    rocksdb::DB* raw = nullptr;
-    auto st = rocksdb::DB::Open(op, DBPATH, &raw);
-    if (!st.ok()) { std::cerr << st.ToString() << '\n'; exit(1); }
-    db.reset(raw);
-}
-constexpr size_t LRU_LIMIT = 200'000;          // 好きなサイズ
-struct LRUKey { std::string tgt, anc; };
-struct KeyHash {
-    size_t operator()(const LRUKey& k) const {
-        return std::hash<std::string>()(k.tgt) ^ std::hash<std::string>()(k.anc) << 1;
+    else if (lv == MemoryGovernor::HIGH) {
+        store.setMaxQueued(2);
+        if (cap > MIN_CACHE_MB) {
+            lru.resize(std::max(MIN_CACHE_MB, cap / 2));
+            report.add("governor_cache_shrinks", 1);
+            trimHeap();
+        }
     }
-};
-struct KeyEq {
-    bool operator()(const LRUKey& a, const LRUKey& b) const {
-        return a.tgt == b.tgt && a.anc == b.anc;
+    else {
+        store.setMaxQueued(BloodStore::MAX_QUEUED);
+        if (cap < cfg.cacheMB && governor.fits(cap)) lru.resize(std::min(cfg.cacheMB, cap * 2));
     }
-};
+}
 
-std::unordered_map<LRUKey, double, KeyHash, KeyEq> lru;
-std::deque<LRUKey> order;          // push_back / pop_front で単純 LRU
-void lruPut(const LRUKey& k, double v) {
-    lru[k] = v; order.push_back(k);
-    if (order.size() > LRU_LIMIT) {
-        lru.erase(order.front()); order.pop_front();
-    }
+//  前進スイープの表などに使ってよい量 (MB)。番人が有効なら今の空きの半分まで
+size_t buildBudgetMB() {
+    if (!governor.enabled()) return SWEEP_LIMIT_MB;
+    governor.sampleNow();
+    return std::min(SWEEP_LIMIT_MB, governor.headroomMB() / 2);
 }
-bool lruGet(const LRUKey& k, double& v) {
-    auto it = lru.find(k); if (it == lru.end()) return false;
-    v = it->second; return true;
+
+//  OrderedSink の書き出し待ちの上限 (番人が逼迫を検知したら絞る)
+size_t governedWindow(size_t n) { return governor.window(n); }
+
+void printCacheStats() {
+    auto st = lru.stats();
+    const std::uint64_t look = st.hits + st.misses;
+    std::cout << "[cache] " << lru.capacityMB() << " MB, entries=" << st.entries
+        << ", hit=" << st.hits << ", miss=" << st.misses
+        << ", evict=" << st.evictions
+        << ", hit率=" << std::fixed << std::setprecision(1)
+        << (look ? 100.0 * st.hits / look : 0.0) << "%\n";
+}
+
+//  実行レポート (--report) を書き出す。キャッシュ段ごとの件数は終了時にまとめて集める
+void writeRunReport(const std::string& path, const std::string& mode, const std::string& query) {
+    if (!report.enabled()) return;
+    const auto st = lru.stats();
+    report.note("mode", mode);
+    report.note("query", query);
+    report.set("horses", ped.size());
+    report.set("threads", cfg.threads);
+    report.set("lru_hits", st.hits);
+    report.set("lru_misses", st.misses);
+    report.set("lru_evictions", st.evictions);
+    report.set("store_hits", store.getCount());
+    report.set("store_puts", store.putCount());
+    report.set("ancvec_store_hits", store.vecGetCount());
+    report.set("ancvec_store_puts", store.vecPutCount());
+    report.set("store_put_bytes", store.putByteCount());
+    if (governor.enabled()) {
+        report.set("governor_budget_mb", governor.budgetMB());
+        report.set("governor_peak_mb", governor.peakMB());
+        report.set("governor_high", governor.highCount());
+        report.set("governor_critical", governor.criticalCount());
+        report.set("lru_capacity_mb", lru.capacityMB());
+    }
+    if (report.write(path)) std::cout << "[report] " << path << '\n';
+    else std::cerr << "cannot write " << path << '\n';
 }
 
 //------------------------- CSV 読込 -------------------------------
+//  mmap + 並列解析は csv_loader.h。ここでは結果の報告だけ
+//  CSV と内容が一致するスナップショットがあればそちらを使う (--compile 時は必ず CSV)
 void loadBloodlineCSV(const std::string& f) {
-    std::ifstream ifs(f);  if (!ifs) { std::cerr << "cannot open " << f << '\n'; exit(1); }
-    std::string head; getline(ifs, head);
-    std::string ln;  int cnt = 0;
-    while (getline(ifs, ln)) {
-        if (ln.empty()) continue;
-        auto c = splitCSV(ln); if (c.size() < 9) continue;
-        Horse h;
-        h.PrimaryKey = c[0];
-        h.Sire = c[1].empty() ? UNKNOWN_SIRE : c[1];
-        h.Dam = c[2].empty() ? UNKNOWN_DAM : c[2];
-        h.YearStr = c[5];  h.YearInt = parseYearInt(c[5]);
-        h.HorseName = c[8];
-        horses[h.PrimaryKey] = h;
-        keyToDisplayName[h.PrimaryKey] = h.HorseName + " [" + h.YearStr + "]";
-        childrenOf[h.Sire].push_back(h.PrimaryKey);
-        childrenOf[h.Dam].push_back(h.PrimaryKey);
-        ++cnt;
-    }
-    std::cout << "[load] " << cnt << " rows, horses=" << horses.size() << '\n';
+    std::uint64_t csvHash = 0;
+    if (!snapshot::hashFile(f, csvHash)) { std::cerr << "cannot open " << f << '\n'; exit(1); }
+    if (!cfg.compile) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (loadSnapshot(cfg.snapshotPath, ped, csvHash)) {
+            std::cout << "[load] snapshot " << cfg.snapshotPath << ": horses=" << ped.size() << ", "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0).count() << " ms\n";
+            if (!ped.acyclic)
+                std::cerr << "[load] 血統に循環があります ("
+                    << ped.size() - ped.topo.size() << " 頭) → 再帰計算で処理します\n";
+            return;
+        }
+    }
+
+    CsvLoadStats st;
+    if (!loadPedigreeCSV(f, ped, cfg.threads, st)) { std::cerr << "cannot open " << f << '\n'; exit(1); }
+    std::cout << "[load] " << st.rows << " rows, horses=" << ped.size() << '\n';
+    std::cout << "[load] " << std::fixed << std::setprecision(3) << st.seconds << " s ("
+        << std::setprecision(0) << (st.seconds > 0 ? st.rows / st.seconds : 0.0) << " rows/s, "
+        << std::setprecision(1) << (st.seconds > 0 ? st.bytes / st.seconds / (1024 * 1024) : 0.0)
+        << " MB/s)\n";
+    std::cout.unsetf(std::ios::floatfield);  std::cout << std::setprecision(6);
+    if (!ped.acyclic)
+        std::cerr << "[load] 血統に循環があります ("
+            << ped.size() - ped.topo.size() << " 頭) → 再帰計算で処理します\n";
+
+    if (cfg.compile) {
+        if (!writeSnapshot(cfg.snapshotPath, ped, csvHash)) {
+            std::cerr << "cannot write " << cfg.snapshotPath << '\n';  exit(1);
+        }
+        std::cout << "[compile] " << cfg.snapshotPath << " を作成しました\n";
+    }
 }
+//------------------------- 差分取込 -------------------------------
+//  --delta FILE : 新しい馬と父母の訂正を ped に反映し、RocksDB からは父母が変わった馬の
+//  子孫の値だけを消す (残りの保存値はそのまま使える)。そのあと bloodline.csv の末尾に
+//  変わった行を書き足し、スナップショットがあれば作り直す
+//  ※ DB の版と CSV は指紋で突き合わせるので、途中で止まっても次回は作り直しになるだけ
+int runDelta(const std::string& csvPath, const std::string& deltaPath) {
+    {
+        auto ph = report.phase("store_open");
+        store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat);   // 差分前の版で開く
+    }
+    PedigreeDelta d;
+    {
+        auto ph = report.phase("delta_apply");
+        if (!applyPedigreeDelta(ped, deltaPath, csvPath, d)) { std::cerr << "cannot open " << deltaPath << '\n';  return 1; }
+    }
+    std::cout << "[delta] " << d.rows << " rows: added=" << d.added.size() << ", reparented="
+        << d.reparented.size() << " (relinked " << d.relinked << "), attr only=" << d.attrOnly
+        << ", affected=" << d.affected.size() << ", " << std::fixed << std::setprecision(3) << d.seconds << " s\n";
+    std::cout.unsetf(std::ios::floatfield);  std::cout << std::setprecision(6);
+    if (!ped.acyclic)
+        std::cerr << "[delta] 血統に循環があります (" << ped.size() - ped.topo.size() << " 頭)\n";
+    {
+        auto ph = report.phase("delta_invalidate");
+        const size_t ranges = store.invalidate(d.affected, ped.fingerprint());
+        std::cout << "[delta] " << d.affected.size() << " 頭の保存値を削除 (" << ranges << " 範囲)\n";
+        report.set("delta_ranges", ranges);
+    }
+    {
+        auto ph = report.phase("store_close");
+        store.close();
+    }
+
+    if (!d.appendText.empty()) {
+        auto ph = report.phase("delta_write");
+        std::uint64_t size = 0;
+        bool needNl = false;
+        {
+            MappedFile mf;
+            if (mf.open(csvPath) && (size = mf.size()) > 0) needNl = mf.data()[size - 1] != '\n';
+        }
+        std::ofstream ofs(csvPath, std::ios::binary | std::ios::app);
+        if (needNl) ofs.put('\n');
+        ofs.write(d.appendText.data(), std::streamsize(d.appendText.size()));
+        ofs.close();
+        if (!ofs) { std::cerr << "cannot write " << csvPath << '\n';  return 1; }
+        std::cout << "[delta] " << csvPath << " に " << d.appendText.size() << " bytes 追記しました\n";
+
+        // 一時ファイルに書いてから置き換える。書けなければ古い版 (CSV と合わない) を消しておく
+        std::uint64_t csvHash = 0;
+        if (std::filesystem::exists(cfg.snapshotPath) && snapshot::hashFile(csvPath, csvHash)) {
+            if (writeSnapshot(cfg.snapshotPath, ped, csvHash)) std::cout << "[delta] " << cfg.snapshotPath << " を作り直しました\n";
+            else {
+                std::error_code ec;
+                std::filesystem::remove(cfg.snapshotPath, ec);
+                std::cerr << "cannot write " << cfg.snapshotPath << " (削除しました。次回は CSV から読みます)\n";
+            }
+        }
+    }
+
+    report.set("delta_rows", d.rows);
+    report.set("delta_added", d.added.size());
+    report.set("delta_reparented", d.reparented.size());
+    report.set("delta_affected", d.affected.size());
+    return 0;
+}
+
+//------------------------- スレッドごとの作業領域 -------------------------------
+//  N 頭ぶんの配列を持つので、初回の呼び出しで確保される。常駐サーバはワーカー起動時に先に呼ぶ
+AncestryEngine& threadEngine() {
+    thread_local AncestryEngine eng(ped);
+    return eng;
+}
+ApproxAncestryEngine& threadApproxEngine() {
+    thread_local ApproxAncestryEngine eng(ped, cfg.approx);
+    return eng;
+}
+
+//------------------------- 近似モード -------------------------------
+//  --max-depth / --min-contrib のときの祖先ベクトルと 1 セル。本体は approx_blood.h
+//  厳密値の LRU / RocksDB キー / 祖先ベクトルには触れない (approx 列ファミリだけを使う)
+//  戻り値 = このベクトルの誤差の上限 (使い回す側が approxStats.note し直すため)
+double approxOf(HorseId t, AncestryVec& v) {
+    ApproxVec a;
+    if (!store.getApprox(t, cfg.approx, a)) {
+        threadApproxEngine().compute(t, a);
+        store.putApprox(t, cfg.approx, a);
+        ++approxStats.computed;
+    }
+    ++approxStats.vectors;
+    approxStats.note(a.bound);
+    v.swap(a.v);
+    return a.bound;
+}
+
+//  循環が無ければ tgt の近似祖先ベクトルから引く (スレッドごとに直前の 1 本を持つ)。
+//  循環があれば getBlood と同じ再帰を枝切り付きで
+double approxBlood(HorseId tgt, HorseId anc, std::unordered_set<HorseId>& stk) {
+    if (ped.acyclic) {
+        thread_local HorseId last = NO_HORSE;
+        thread_local AncestryVec vec;
+        thread_local double bound = 0.0;
+        if (last != tgt) { bound = approxOf(tgt, vec);  last = tgt; }
+        else approxStats.note(bound);                 // 前のクエリの残りでも上限は数える
+        return ancestryGet(vec, anc);
+    }
+    double dropped = 0.0;
+    const double v = approxBloodPaths(ped, tgt, anc, cfg.approx, stk, 0, 1.0, dropped);
+    approxStats.note(dropped);
+    return v;
+}
+
+// 出力ファイル名に付ける印 (厳密値のファイルを上書きしないため)
+//  子孫側 (File-A / --top の carriers, descSide) は循環が無ければ前進スイープ・枝刈りの厳密値なので付けない
+std::string approxSuffix(bool descSide = false) {
+    if (!cfg.approx.enabled() || (descSide && ped.acyclic)) return "";
+    return "_approx_" + cfg.approx.tag();
+}
+
+void printApproxSummary() {
+    if (!cfg.approx.enabled()) return;
+    std::ostringstream b;
+    b << approxStats.maxBound.load();
+    std::cout << "[approx] " << cfg.approx.tag() << ": 祖先ベクトル " << approxStats.vectors
+        << " 本 (計算 " << approxStats.computed << "), 誤差の上限 " << b.str()
+        << " (出力値 ≤ 厳密値 ≤ 出力値 + 上限"
+        << (ped.acyclic ? "。祖先側の出力だけ。子孫側 (File-A / carriers) は厳密値)\n" : ")\n");
+    if (!ped.acyclic)
+        std::cout << "[approx] 循環があるため近似は経路を 1 本ずつたどります (メモ化なし)。"
+            "遅い場合は --max-depth / --min-contrib を強めるか、近似を外してください\n";
+    report.note("approx", cfg.approx.tag());
+    report.note("approx_error_bound", b.str());
+}
+
 //------------------------- 血量計算（メモ化） -------------------------------
-double getBlood(const std::string& tgt, const std::string& anc,
-    std::unordered_set<std::string>& stk)
+//  tgt / anc は ID。RocksDB 側も ID の固定長キー (血統表の版で保護)
+double getBlood(HorseId tgt, HorseId anc, std::unordered_set<HorseId>& stk)
 {
-    LRUKey key{ tgt,anc };
+    // 不明の親 (NO_HORSE) は血量 0
+    if (tgt == NO_HORSE) return 0.0;
+    if (cfg.approx.enabled()) return approxBlood(tgt, anc, stk);   // 厳密値のキャッシュは使わない
+
+    const BloodCache::Key key = BloodCache::makeKey(tgt, anc);
     double val;
 
     // 1) LRU → RocksDB → 再計算 の 3 段階
-    if (lruGet(key, val)) return val;
+    if (lru.get(key, val)) return val;
 
-    std::string vstr;
-    if (db->Get(rocksdb::ReadOptions(), tgt + "|" + anc, &vstr).ok()) {
-        val = std::stod(vstr);
-        lruPut(key, val);
+    if (store.get(tgt, anc, val)) {
+        lru.put(key, val);
         return val;
     }
 
     // ---- 以下は以前の再帰計算ロジック ----
-    if (tgt == UNKNOWN_SIRE || tgt == UNKNOWN_DAM || !horses.count(tgt))
-        val = 0.0;
-    else if (tgt == anc) val = 1.0;
+    if (tgt == anc) val = 1.0;
     else if (stk.count(tgt)) val = 0.0;
     else {
         stk.insert(tgt);
-        const Horse& h = horses[tgt];
-        val = 0.5 * getBlood(h.Sire, anc, stk) + 0.5 * getBlood(h.Dam, anc, stk);
+        val = 0.5 * getBlood(ped.sire[tgt], anc, stk) + 0.5 * getBlood(ped.dam[tgt], anc, stk);
         stk.erase(tgt);
     }
 
+    report.recompute(stk.size());
+
     // 2) RocksDB + LRU に保存
-    db->Put(rocksdb::WriteOptions(), tgt + "|" + anc, std::to_string(val));
-    lruPut(key, val);
+    store.put(tgt, anc, val);
+    lru.put(key, val);
     return val;
 }
 
+//------------------------- 祖先ベクトル (遅延充填) -------------------------------
+//  RocksDB の ancvec にあれば 1 回の Get + 復号、無ければ計算して保存する
+//  近似モードでは近似ベクトル。exact = true なら常に厳密 (kinship 用)
+//  bounds を渡すと近似ベクトルごとの誤差の上限も返す (バッチの共有用)
+void ancestryVectors(const std::vector<HorseId>& targets, std::vector<AncestryVec>& out, bool exact = false,
+    std::vector<double>* bounds = nullptr)
+{
+    out.assign(targets.size(), {});
+    if (cfg.approx.enabled() && !exact) {
+        if (bounds) bounds->assign(targets.size(), 0.0);
+        for (size_t j = 0; j < targets.size(); ++j) {
+            double b;
+            auto it = shared.anc.find(targets[j]);
+            if (it != shared.anc.end()) {
+                out[j] = it->second;
+                b = shared.ancBound[targets[j]];
+                ++approxStats.vectors;
+                approxStats.note(b);
+            }
+            else b = approxOf(targets[j], out[j]);
+            if (bounds) (*bounds)[j] = b;
+        }
+        return;
+    }
+    std::vector<HorseId> miss;
+    std::vector<size_t>  missCol;
+    size_t reused = 0;
+    for (size_t j = 0; j < targets.size(); ++j) {
+        auto it = shared.anc.find(targets[j]);
+        if (it != shared.anc.end()) { out[j] = it->second;  ++reused; }
+        else if (!store.getAncestry(targets[j], out[j])) { miss.push_back(targets[j]); missCol.push_back(j); }
+    }
+
+    if (!miss.empty()) {
+        std::vector<AncestryVec> fresh;
+        AncestryEngine(ped).computeMany(miss, fresh);
+        for (size_t i = 0; i < miss.size(); ++i) {
+            store.putAncestry(miss[i], fresh[i]);
+            out[missCol[i]].swap(fresh[i]);
+        }
+    }
+    report.add("ancvec_shared", reused);
+    report.add("ancvec_loaded", targets.size() - miss.size() - reused);
+    report.add("ancvec_computed", miss.size());
+    std::cout << "[ancvec] " << reused << " shared, " << targets.size() - miss.size() - reused
+        << " loaded, " << miss.size() << " computed\n";
+}
+
+// 祖先ベクトル 1 頭ぶん (RocksDB → 無ければ計算して保存)。作業領域はスレッドごと
+void ancestryOf(HorseId t, AncestryVec& v) {
+    if (cfg.approx.enabled()) { approxOf(t, v);  return; }
+    if (store.getAncestry(t, v)) return;
+    threadEngine().compute(t, v);
+    store.putAncestry(t, v);
+}
+
 //------------------------- 祖先・子孫セット -------------------------------
-void collectAncestors(const std::string& pk, std::unordered_set<std::string>& s) {
-    if (pk == UNKNOWN_SIRE || pk == UNKNOWN_DAM || !horses.count(pk)) return;
-    const Horse& h = horses[pk];
-    for (const auto& p : { h.Sire,h.Dam })
-        if (s.insert(p).second) collectAncestors(p, s);
+//  1 頭ぶん。本体は closure.h (ビット集合・明示スタック)。複数頭は ancestorsOf / descendantsOf に
+//  まとめて渡せば 1 回の走査で済む
+void collectAncestors(HorseId id, HorseSet& s) { ancestorsOf(ped, { id }, s); }
+void collectDescendants(HorseId id, HorseSet& s) { descendantsOf(ped, { id }, s); }
+
+//------------------------- 祖先 → (列, 値) の CSR (File-B) -------------------------------
+//  対象馬ごとの祖先ベクトルを集めて組み替える。メモリ番人が有効なら列を GROUP 頭ずつ読み、
+//  全ベクトルを抱えると予算を超えそうな時点で手放す。その場合は数えるだけにして
+//  (ベクトルは RocksDB に保存済み)、CSR を確保してから 1 本ずつ読み直して詰める
+void buildAncestorCSR(const std::vector<HorseId>& cols, std::vector<std::uint32_t>& begin,
+    std::vector<std::pair<std::uint32_t, double>>& cells)
+{
+    constexpr size_t GROUP = 1024;
+    const size_t n = ped.size();
+    std::vector<AncestryVec> vecs;
+    bool resident = true;
+    begin.assign(n + 1, 0);
+    if (!governor.enabled()) {
+        ancestryVectors(cols, vecs);
+        for (const auto& v : vecs) for (const auto& e : v) ++begin[e.first + 1];
+    }
+    else {
+        std::uint64_t nnz = 0;
+        for (size_t g0 = 0; g0 < cols.size(); g0 += GROUP) {
+            const std::vector<HorseId> grp(cols.begin() + g0, cols.begin() + std::min(cols.size(), g0 + GROUP));
+            std::vector<AncestryVec> part;
+            ancestryVectors(grp, part);
+            for (const auto& v : part) {
+                nnz += v.size();
+                for (const auto& e : v) ++begin[e.first + 1];
+            }
+            if (!resident) continue;
+            // 残りの列も同じ密度として、ベクトル + CSR の見込み
+            const std::uint64_t projected = nnz * cols.size() / (g0 + grp.size());
+            const size_t needMB = size_t(projected * (sizeof(AncestryVec::value_type) + sizeof(cells[0])) >> 20);
+            governor.sampleNow();
+            if (governor.fits(needMB))
+                for (auto& v : part) vecs.push_back(std::move(v));
+            else {
+                resident = false;
+                std::vector<AncestryVec>().swap(vecs);
+                std::cout << "[ancvec] 見込み " << needMB << " MB が予算を超えるため RocksDB から読み直します\n";
+                report.add("ancvec_streamed", 1);
+            }
+        }
+    }
+    for (size_t i = 0; i < n; ++i) begin[i + 1] += begin[i];
+    cells.resize(begin[n]);
+    std::vector<std::uint32_t> pos(begin.begin(), begin.end() - 1);
+    if (resident) {
+        for (size_t ci = 0; ci < vecs.size(); ++ci) {
+            for (const auto& e : vecs[ci]) cells[pos[e.first]++] = { (std::uint32_t)ci, e.second };
+            AncestryVec().swap(vecs[ci]);
+        }
+        return;
+    }
+    store.flush();
+    AncestryVec v;
+    for (size_t ci = 0; ci < cols.size(); ++ci) {
+        ancestryOf(cols[ci], v);
+        for (const auto& e : v) cells[pos[e.first]++] = { (std::uint32_t)ci, e.second };
+    }
 }
-void collectDescendants(const std::string& pk, std::unordered_set<std::string>& s) {
-    std::queue<std::string> q; q.push(pk);
-    while (!q.empty()) {
-        std::string cur = q.front(); q.pop();
-        for (const auto& ch : childrenOf[cur])
-            if (s.insert(ch).second) q.push(ch);
+//------------------------- 書き出しの失敗 -------------------------------
+//  開けない / 書き切れなかった出力は残さず、実行全体を失敗 (終了コード 1) にする
+[[noreturn]] void outputFailed(const std::string& file, bool opened = true) {
+    std::cerr << (opened ? "cannot write " : "cannot open ") << file << '\n';
+    std::error_code ec;
+    if (opened) std::filesystem::remove(file, ec);
+    exit(1);
+}
+
+//------------------------- 行列ファイルの先頭・1 行 -------------------------------
+//  saveCSVMatrix_Smart と --shards の統合で共用 (どちらも同じバイト列になるように)
+//  ヘッダ (csv 以外はラベルを別ファイルへ)。ラベルを書けなければ false
+bool writeMatrixHead(CsvOut& ofs, const std::string& filename,
+    const std::vector<HorseId>& rows, const std::vector<HorseId>& cols)
+{
+    std::string header;
+    if (cfg.format == MatrixFormat::CSV) {
+        header = "HorseName";
+        for (HorseId ck : cols) header.append(",").append(ped.display[ck]);
+        header.push_back('\n');
     }
+    else {
+        for (auto lab : { std::make_pair(".rows.txt", &rows), std::make_pair(".cols.txt", &cols) }) {
+            CsvOut lf(filename + lab.first);
+            for (HorseId id : *lab.second) lf.put(ped.display[id]).put('\n');
+            if (!lf.close()) { std::cerr << "cannot write " << filename << lab.first << '\n';  return false; }
+        }
+        matrixHeader(cfg.format, cfg.f32, rows.size(), cols.size(), header);
+    }
+    ofs.put(header);
+    return true;
 }
+
+void appendMatrixRow(size_t ri, HorseId rk, const std::vector<double>& vals, std::string& out) {
+    if (cfg.format == MatrixFormat::CSV) out.append(ped.display[rk]);
+    matrixRow(cfg.format, cfg.f32, (std::uint32_t)ri, vals.data(), vals.size(), out);
+}
+
+//  部分ファイルの署名: 血統・行数・担当列・向きが同じときだけ続きから再開する
+std::uint64_t shardSignature(const std::vector<HorseId>& rows, const std::vector<HorseId>& cols, bool transpose) {
+    std::uint64_t h = ped.fingerprint();
+    auto mix = [&](std::uint64_t x) { for (int i = 0; i < 8; ++i) { h ^= (x >> (8 * i)) & 0xFF;  h *= 1099511628211ULL; } };
+    mix(rows.size());  mix(transpose);
+    for (HorseId c : cols) mix(c);
+    return h;
+}
+
 //--------------------------------------------------------------------
 // 行列 CSV 出力  (transpose==true で行列を入れ替えて出力)
 //
@@ -217,11 +608,10 @@ void collectDescendants(const std::string& pk, std::unordered_set<std::string>&
 // 行列 CSV 出力  (transpose==true で行列を入れ替えて出力)
 //--------------------------------------------------------------------
 void saveCSVMatrix_Smart(const std::string& filename,
-    const std::vector<std::string>& rowKeys,
-    const std::vector<std::string>& colKeys,
+    const std::vector<HorseId>& rowKeys,
+    const std::vector<HorseId>& colKeys,
     bool transpose,
-    const std::function<bool(const std::string&,
-        const std::string&)>& calcFilter)
+    const std::function<bool(HorseId, HorseId)>& calcFilter)
 {
     if (rowKeys.empty() || colKeys.empty()) {
         std::cerr << "[saveCSVMatrix] rows/cols empty → skip\n";
@@ -229,34 +619,98 @@ void saveCSVMatrix_Smart(const std::string& filename,
     }
 
     const auto& rows = transpose ? colKeys : rowKeys;  // ⇐ 行
-    const auto& cols = transpose ? rowKeys : colKeys;  // ⇐ 列
+    const auto& allCols = transpose ? rowKeys : colKeys;
 
-    std::ofstream ofs(filename);
-    if (!ofs) { std::cerr << "cannot open " << filename << '\n'; return; }
-    ofs << std::fixed << std::setprecision(8);
+    // --- --shard I/N のワーカー: 担当の列だけを部分ファイルへ (shard.h) ---
+    std::vector<HorseId> colSlice;
+    MatrixPart part;
+    size_t startRow = 0;
+    const std::string partPath = shardPartPath(filename, cfg.shard);
+    if (cfg.shard.active()) {
+        const auto span = cfg.shard.range(allCols.size());
+        colSlice.assign(allCols.begin() + span.first, allCols.begin() + span.second);
+        startRow = part.open(partPath, rows.size(), colSlice.size(), shardSignature(rows, colSlice, transpose));
+        if (startRow == SIZE_MAX) outputFailed(partPath, false);
+        if (startRow == rows.size() || colSlice.empty()) {
+            part.finish();
+            std::cout << "[shard] " << partPath << " は完了済み\n";
+            return;
+        }
+        if (startRow) std::cout << "[shard] " << partPath << " を " << startRow << " 行目から再開\n";
+    }
+    const auto& cols = cfg.shard.active() ? colSlice : allCols;   // ⇐ 列
 
-    // --- ヘッダ ---
-    ofs << "HorseName";
-    for (const auto& ck : cols) ofs << ',' << keyToDisplayName[ck];
-    ofs << '\n';
+    std::unique_ptr<CsvOut> ofs;
+    if (!cfg.shard.active()) {
+        ofs = std::make_unique<CsvOut>(filename, isBinaryFormat(cfg.format), cfg.gzip);
+        if (!ofs->ok()) outputFailed(filename, false);
+        if (!writeMatrixHead(*ofs, filename, rows, cols)) outputFailed(filename);
+    }
 
-    // --- 本文 ---
-    const size_t total = rows.size();
-    size_t idx = 0;
-    for (const auto& rk : rows) {
-        ++idx;
-        std::cout << "[Matrix] (" << idx << '/' << total << ")  "
-            << keyToDisplayName[rk] << '\n';
+    // --- 前進スイープ (File-A 向き: 行 = 子孫, 列 = 対象馬) ---
+    //   循環が無ければ全セルを先に求める。表がメモリに収まらなければ列の帯ごとに
+    //   スピルファイルへ書き、行ごとに読み戻す。バッチ実行で全列が共有スイープに載っていればそれを使う
+    DescBloodTable ownSweep;
+    SpilledDescTable spill;
+    const std::string spillPath = (cfg.shard.active() ? partPath : filename) + ".spill";
+    bool useSpill = false;
+    std::atomic<bool> spillFailed{ false };
+    const DescBloodTable* sweep = &shared.sweep;
+    std::vector<std::uint32_t> sweepIdx(cols.size());
+    bool useSweep = !transpose && ped.acyclic;
+    for (size_t ci = 0; useSweep && ci < cols.size() && sweep == &shared.sweep; ++ci)
+        if (!shared.sweepColumn(cols[ci], sweepIdx[ci])) sweep = &ownSweep;
+    if (useSweep && sweep == &ownSweep) {
+        const size_t budgetMB = buildBudgetMB();
+        if (descBloodTableMB(ped, cols.size()) <= budgetMB) sweepDescBlood(ped, cols, ownSweep, cfg.threads);
+        else {
+            const size_t band = std::max<size_t>(1,
+                budgetMB * 1024 * 1024 / (std::max<size_t>(1, ped.size()) * sizeof(double)));
+            useSweep = useSpill = spill.build(ped, cols, band, spillPath, cfg.threads);
+            if (useSpill) {
+                std::cout << "[sweep] " << descBloodTableMB(ped, cols.size()) << " MB > " << budgetMB
+                    << " MB → " << band << " 列ずつスピル\n";
+                report.add("sweep_spilled", 1);
+            }
+        }
+        for (size_t ci = 0; ci < cols.size(); ++ci) sweepIdx[ci] = std::uint32_t(ci);
+    }
 
-        ofs << keyToDisplayName[rk];
+    // --- 祖先ベクトル (File-B 向き: 行 = 祖先, 列 = 対象馬) ---
+    //   対象馬ごとの疎ベクトルを作り、祖先 → (列, 値) の CSR に組み替える
+    const bool useAncVec = transpose && ped.acyclic;
+    std::vector<std::uint32_t> ancBegin;
+    std::vector<std::pair<std::uint32_t, double>> ancCells;   // (列, 値)
+    if (useAncVec) buildAncestorCSR(cols, ancBegin, ancCells);
 
-        for (const auto& ck : cols) {
+    // --- 1 行ぶんの文字列化 (rowBuf / vals はスレッドごとの作業領域) ---
+    auto formatRow = [&](size_t ri, std::vector<double>& rowBuf, std::vector<double>& vals,
+        SpilledDescTable::Reader& rd, std::string& out) {
+        const HorseId rk = rows[ri];
+
+        if (spillFailed) return;                          // どうせ書かない
+        if (useSpill && !spill.readRow(rk, rowBuf.data(), rd)) { spillFailed = true;  return; }
+
+        if (useAncVec)
+            for (auto c = ancBegin[rk]; c < ancBegin[rk + 1]; ++c)
+                rowBuf[ancCells[c].first] = ancCells[c].second;
+
+        for (size_t ci = 0; ci < cols.size(); ++ci) {
+            const HorseId ck = cols[ci];
             bool need = calcFilter(transpose ? ck : rk,   // row/col を元順で渡す
                 transpose ? rk : ck);
 
             double v = 0.0;
-            if (need) {
-                std::unordered_set<std::string> st;
+            if (need && useSweep) {
+                v = useSpill ? rowBuf[ci] : sweep->get(rk, sweepIdx[ci]);
+                if (std::fabs(v) < 1e-12) v = 0.0;
+            }
+            else if (need && useAncVec) {
+                v = rowBuf[ci];
+                if (std::fabs(v) < 1e-12) v = 0.0;
+            }
+            else if (need) {
+                std::unordered_set<HorseId> st;
 
                 // ★ 行列を転置したときだけ引数の向きを入れ替える
                 v = transpose
@@ -265,11 +719,71 @@ void saveCSVMatrix_Smart(const std::string& filename,
 
                 if (std::fabs(v) < 1e-12) v = 0.0;
             }
-            ofs << ',' << v;
+            vals[ci] = v;
+        }
+        if (cfg.shard.active())
+            out.append(reinterpret_cast<const char*>(vals.data()), vals.size() * sizeof(double));
+        else appendMatrixRow(ri, rk, vals, out);
+
+        if (useAncVec)
+            for (auto c = ancBegin[rk]; c < ancBegin[rk + 1]; ++c)
+                rowBuf[ancCells[c].first] = 0.0;
+    };
+
+    // --- 本文 ---
+    //   行を ROW_CHUNK 行ずつのチャンクに分けてワーカーで文字列化し、
+    //   書き出しはこのスレッドだけがチャンク番号順に行う (出力は直列版と同一)
+    //   ワーカー (--shard) は値をそのまま部分ファイルへ書き、約 1 秒ごとにチェックポイント。
+    //   チェックポイントはチャンクの境目なので、再開は firstChunk から
+    constexpr size_t ROW_CHUNK = 64;
+    const size_t total = rows.size();
+    const size_t firstChunk = startRow / ROW_CHUNK;
+    const size_t chunks = (total + ROW_CHUNK - 1) / ROW_CHUNK - firstChunk;
+    WorkStealingPool pool(cfg.threads);
+    OrderedSink sink(chunks, 4 * pool.size());
+    sink.limit(governedWindow);
+    std::vector<std::vector<double>> rowBufs(pool.size(),
+        std::vector<double>(useAncVec || useSpill ? cols.size() : 0, 0.0));
+    std::vector<std::vector<double>> valBufs(pool.size(), std::vector<double>(cols.size()));
+    std::vector<SpilledDescTable::Reader> spillReaders(pool.size());
+
+    std::thread compute([&] {
+        pool.run(chunks, [&](size_t t, unsigned w) {
+            const size_t c = firstChunk + t;
+            std::string text;
+            for (size_t i = c * ROW_CHUNK; i < std::min(total, (c + 1) * ROW_CHUNK); ++i)
+                formatRow(i, rowBufs[w], valBufs[w], spillReaders[w], text);
+            sink.put(t, std::move(text));
+        });
+    });
+    Progress prog(cfg.progressMs, cfg.quiet);
+    auto lastCkpt = std::chrono::steady_clock::now();
+    bool partOk = true;
+    sink.drain([&](size_t t, const std::string& text) {
+        if (spillFailed) return;     // 読めなかった行を含むチャンク以降は書かない (チェックポイントも進めない)
+        const size_t last = std::min(total, (firstChunk + t + 1) * ROW_CHUNK);
+        if (prog.due(last, total))
+            std::cout << "[Matrix] (" << last << '/' << total << ")  "
+                << ped.display[rows[last - 1]] << '\n';
+        if (!ofs) {
+            partOk = partOk && part.append(text);
+            const auto now = std::chrono::steady_clock::now();
+            if (partOk && now - lastCkpt >= std::chrono::seconds(1)) { partOk = part.checkpoint(last);  lastCkpt = now; }
         }
-        ofs << '\n';
+        else ofs->put(text);
+    });
+    compute.join();
+    if (spillFailed) {
+        // 欠けた行列は残さない。--shard の部分ファイルは最後のチェックポイントまで有効なので、そこから再開できる
+        std::cerr << "cannot read " << spillPath << '\n';
+        std::error_code ec;
+        if (ofs) { ofs->close();  std::filesystem::remove(filename, ec); }
+        std::filesystem::remove(spillPath, ec);
+        exit(1);
     }
-    std::cout << "[Matrix] " << filename << " 出力完了\n";
+    if (ofs) { if (!ofs->close()) outputFailed(filename); }
+    else if (!(partOk && part.finish())) { std::cerr << "cannot write " << partPath << '\n';  exit(1); }
+    std::cout << "[Matrix] " << (ofs ? filename : partPath) << " 出力完了\n";
 }
 
 
@@ -279,168 +793,385 @@ void saveCSVMatrix_Smart(const std::string& filename,
 // 出力 A  (行＝全馬, 列＝対象 1 頭)  ―― 進捗・値付き
 //-------------------------------------------------------------
 void saveDescFast(const std::string& out,
-    const std::vector<std::string>& rows,
-    const std::unordered_set<std::string>& setDesc,
-    const std::string& target)
+    const std::vector<HorseId>& rows,
+    const HorseSet& setDesc,
+    HorseId target)
 {
-    std::ofstream ofs(out);
-    ofs << std::fixed << std::setprecision(8);
-    ofs << "HorseName," << keyToDisplayName[target] << '\n';
+    CsvOut ofs(out);
+    if (!ofs.ok()) outputFailed(out, false);
+    ofs.put("HorseName,").put(ped.display[target]).put('\n');
+
+    // 循環が無ければ前進スイープ 1 回で全馬ぶんを求める (バッチの共有スイープがあればそれを使う)
+    DescBloodTable ownSweep;
+    const DescBloodTable* sweep = &shared.sweep;
+    std::uint32_t col = 0;
+    if (ped.acyclic && !shared.sweepColumn(target, col)) {
+        sweepDescBlood(ped, { target }, ownSweep);
+        sweep = &ownSweep;
+    }
 
     const size_t total = rows.size();
     size_t idx = 0;
-    for (const auto& rk : rows) {
+    Progress prog(cfg.progressMs, cfg.quiet);
+    for (HorseId rk : rows) {
         ++idx;
         double v = 0.0;
         bool needCalc = setDesc.count(rk);
         if (needCalc) {
-            std::unordered_set<std::string> stk;
-            v = getBlood(rk, target, stk);
+            if (ped.acyclic) v = sweep->get(rk, col);
+            else {
+                std::unordered_set<HorseId> stk;
+                v = getBlood(rk, target, stk);
+            }
             if (std::fabs(v) < 1e-12) v = 0.0;
         }
         //--------------- saveDescFast 内 ------------------------------------
-        double v_pct = std::floor(v * 1'000'000.0) / 10'000.0;  // 5 桁切り捨て
-        std::cout << "[A] (" << idx << '/' << total << ")  "
-            << keyToDisplayName[rk] << "  "
-            << (needCalc ? "[calc: " : "[skip: ")
-            << std::fixed << std::setprecision(5) << v_pct << "%]\n";
-
+        if (prog.due(idx, total)) {
+            double v_pct = std::floor(v * 1'000'000.0) / 10'000.0;  // 5 桁切り捨て
+            std::cout << "[A] (" << idx << '/' << total << ")  "
+                << ped.display[rk] << "  "
+                << (needCalc ? "[calc: " : "[skip: ")
+                << std::fixed << std::setprecision(5) << v_pct << "%]\n";
+        }
 
         // ---- CSV 書き込み ----
-        ofs << keyToDisplayName[rk] << ',' << std::setprecision(8) << v << '\n';
+        ofs.put(ped.display[rk]).put(',').putFixed(v).put('\n');
     }
+    if (!ofs.close()) outputFailed(out);
 }
 
 //-------------------------------------------------------------
 // 出力 B  (縦長 1 列)  ―― 進捗・値付き
 //-------------------------------------------------------------
 void saveAncVert(const std::string& out,
-    const std::vector<std::string>& all,
-    const std::unordered_set<std::string>& setAnc,
-    const std::string& target)
+    const std::vector<HorseId>& all,
+    const HorseSet& setAnc,
+    HorseId target)
 {
-    std::ofstream ofs(out);
-    ofs << std::fixed << std::setprecision(8);
-    ofs << "HorseName," << keyToDisplayName[target] << '\n';
+    CsvOut ofs(out);
+    if (!ofs.ok()) outputFailed(out, false);
+    ofs.put("HorseName,").put(ped.display[target]).put('\n');
+
+    // 循環が無ければ逆向き伝播 1 回で祖先ベクトルを作り、全馬ぶんに展開
+    std::vector<double> dense;
+    if (ped.acyclic) {
+        std::vector<AncestryVec> vec;
+        ancestryVectors({ target }, vec);
+        dense.assign(ped.size(), 0.0);
+        for (const auto& e : vec[0]) dense[e.first] = e.second;
+    }
 
     const size_t total = all.size();
     size_t idx = 0;
-    for (const auto& anc : all) {
+    Progress prog(cfg.progressMs, cfg.quiet);
+    for (HorseId anc : all) {
         ++idx;
         double v = 0.0;
         bool needCalc = setAnc.count(anc);
         if (needCalc) {
-            std::unordered_set<std::string> stk;
-            v = getBlood(target, anc, stk);
+            if (ped.acyclic) v = dense[anc];
+            else {
+                std::unordered_set<HorseId> stk;
+                v = getBlood(target, anc, stk);
+            }
             if (std::fabs(v) < 1e-12) v = 0.0;
         }
-        // ---- 進捗ログ ----
-        double v_pct = std::floor(v * 1'000'000.0) / 10'000.0;  // 5 桁切り捨て
-        std::cout << "[B] (" << idx << '/' << total << ")  "
-            << keyToDisplayName[anc] << "  "
-            << (needCalc ? "[calc: " : "[skip: ")
-            << std::fixed << std::setprecision(5) << v_pct << "%]\n";
+        // ---- 進捗ログ (一定間隔ごと) ----
+        if (prog.due(idx, total)) {
+            double v_pct = std::floor(v * 1'000'000.0) / 10'000.0;  // 5 桁切り捨て
+            std::cout << "[B] (" << idx << '/' << total << ")  "
+                << ped.display[anc] << "  "
+                << (needCalc ? "[calc: " : "[skip: ")
+                << std::fixed << std::setprecision(5) << v_pct << "%]\n";
+        }
 
         // ---- CSV 書き込み ----
-        ofs << keyToDisplayName[anc] << ',' << std::setprecision(8) << v << '\n';
+        ofs.put(ped.display[anc]).put(',').putFixed(v).put('\n');
     }
+    if (!ofs.close()) outputFailed(out);
+}
+// 出力ファイル名 = stem + 形式の拡張子 (+ .gz)
+std::string matrixFileName(const std::string& stem) {
+    return stem + matrixExtension(cfg.format) + (cfg.gzip ? ".gz" : "");
 }
-// =========================== main ===========================
-int main() {
-    loadBloodlineCSV("bloodline.csv");
-
-    // --- 入力 ---
-    std::cout << "対象馬 (年/年レンジ/PrimaryKey をカンマ区切り): ";
-    std::string raw;  std::getline(std::cin, raw);
 
-    openDB();                               // RocksDB を開く
+//------------------------- コマンドライン -------------------------------
+//   --threads N   行列出力を N スレッドで計算 (0 = 論理コア数)
+//   --cache-mb N  メモリ内血量キャッシュの容量 (MB)
+//   --mem-budget N 使用メモリの予算 (MB, 既定 0 = 無効)。超えそうならキャッシュを縮め、
+//                 書き出し待ちを絞り、収まらない表はスピルファイル / RocksDB 経由にする
+//   --db PATH     RocksDB キャッシュの場所
+//   --ancvec-float 祖先ベクトルを float で保存 (既定は double)
+//   --compile     bloodline.csv を解析してスナップショットを書き出して終了
+//   --snapshot P  スナップショットの場所 (既定 bloodline.snap)
+//   --progress-ms N 進捗ログの間隔 (ms)
+//   --quiet       進捗ログを出さない
+//   --format F    行列の形式 csv | triplet | npy | bin | sbin
+//   --dtype T     npy / bin / sbin の値の型 f64 | f32
+//   --gzip        出力を gzip で圧縮 (BLOODLINE_WITH_ZLIB ビルドのみ)
+//   --out DIR     出力先フォルダ (既定 D:/AI/C++/out)
+//   --batch FILE  1 行 1 クエリのジョブファイルを一括実行 (ジョブごとに DIR/<行番号>_<label>/)
+//   --serve PATH  Unix ドメインソケット PATH で問い合わせを待ち受ける常駐モード
+//                 (同時に処理する要求数 = --threads。1 のままなら max(4, 論理コア数)。接続数は無制限)
+//   --top K       行列の代わりに、対象馬ごとの上位 K 頭 (子孫 / 祖先) だけを出力
+//   --top-year Y  上位 K 頭を年 Y (または Y1-Y2) の馬に限る
+//   --top-sex S   上位 K 頭を Sex 列が S の馬に限る
+//   --report      工程ごとの時間・キャッシュ段ごとの件数・最大メモリを
+//                 出力先の run_report_<label>.json に書く
+//   --all-pairs   全馬 × 全馬の血量行列を DIR/blood_percentage.<形式> に書く
+//                 (--dtype f32 で作業メモリ半分。収まらなければスピルファイルを使う)
+//   --delta FILE  bloodline.csv と同じ列の CSV (全体の新版 or 差分) を取り込む。
+//                 父母が変わった馬の子孫だけ RocksDB の値を消し、bloodline.csv に追記して終了
+//   --max-depth D 近似モード: 対象馬から D 代までの経路だけを数える
+//   --min-contrib W 近似モード: 重みが W 未満になった枝を切る (0.0001 または 0.01%)
+//                 近似値は別キャッシュ・別ファイル名 (_approx_<条件>)。誤差の上限を表示する
+//                 (File-A は循環が無ければ前進スイープで厳密に求めるので影響せず、印も付かない)
+//                 ※ 循環がある血統では近似も経路を 1 本ずつたどり、メモ化しない。枝切りが
+//                   浅くないと厳密モード (メモ化あり) より遅くなることがある
+//   --shards N    対象馬 (列) を N 個に分け、自分自身を --shard I/N 付きで N 個起動して
+//                 計算させ、部分ファイルを単一プロセスと同じ出力に統合する。ワーカーの
+//                 ログは DIR/shards_<label>/worker<I>.log。失敗したら同じコマンドで再実行すれば
+//                 各ワーカーはチェックポイントの続きから再開する
+//   --shard I/N   ワーカーとして I 番目 (0 始まり) の列だけを部分ファイルに書く。
+//                 RocksDB は <--db>_shard<I> (ワーカーごとに別)
+//   --inbreeding  全馬の近交係数 F を DIR/inbreeding.<形式> に書く
+//   --kinship Q   Q (対話入力と同じ書式) の馬 × --kin-with Q2 の馬 (既定 Q) の kinship を
+//                 DIR/kinship_<label>.<形式> に書く。--kin-sex M,F で行・列を Sex で絞る
+void parseArgs(int argc, char** argv) {
+    cfg.args.assign(argv, argv + std::min(argc, 1));
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a != "--shards") cfg.args.push_back(a);
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) { std::cerr << a << " には値が必要です\n"; exit(1); }
+            if (a != "--shards") cfg.args.push_back(argv[i + 1]);
+            return argv[++i];
+        };
+        if (a == "--threads") {
+            int n = std::stoi(value());
+            cfg.threads = n > 0 ? unsigned(n) : std::max(1u, std::thread::hardware_concurrency());
+        }
+        else if (a == "--cache-mb") cfg.cacheMB = std::stoul(value());
+        else if (a == "--mem-budget") cfg.memBudgetMB = std::stoul(value());
+        else if (a == "--db") cfg.dbPath = value();
+        else if (a == "--ancvec-float") cfg.ancFloat = true;
+        else if (a == "--compile") cfg.compile = true;
+        else if (a == "--snapshot") cfg.snapshotPath = value();
+        else if (a == "--progress-ms") cfg.progressMs = unsigned(std::stoul(value()));
+        else if (a == "--quiet") cfg.quiet = true;
+        else if (a == "--format") {
+            std::string f = value();
+            if (!parseMatrixFormat(f, cfg.format)) { std::cerr << "unknown format: " << f << '\n'; exit(1); }
+        }
+        else if (a == "--dtype") {
+            std::string t = value();
+            if (t != "f64" && t != "f32") { std::cerr << "unknown dtype: " << t << '\n'; exit(1); }
+            cfg.f32 = (t == "f32");
+        }
+        else if (a == "--gzip") {
+            if (!CsvOut::gzipAvailable()) { std::cerr << "--gzip には BLOODLINE_WITH_ZLIB ビルドが必要です\n"; exit(1); }
+            cfg.gzip = true;
+        }
+        else if (a == "--out") cfg.outDir = value();
+        else if (a == "--batch") cfg.batchPath = value();
+        else if (a == "--serve") cfg.servePath = value();
+        else if (a == "--top") cfg.topK = std::stoul(value());
+        else if (a == "--top-year") {
+            std::string y = value();
+            std::smatch m;
+            if (std::regex_match(y, m, std::regex(R"(^(\d{4})(?:-(\d{4}))?$)"))) {
+                cfg.topFilter.yearLo = std::stoi(m[1]);
+                cfg.topFilter.yearHi = m[2].matched ? std::stoi(m[2]) : cfg.topFilter.yearLo;
+                if (cfg.topFilter.yearLo > cfg.topFilter.yearHi) std::swap(cfg.topFilter.yearLo, cfg.topFilter.yearHi);
+            }
+            else { std::cerr << "bad year: " << y << '\n'; exit(1); }
+        }
+        else if (a == "--top-sex") cfg.topFilter.sex = value();
+        else if (a == "--report") cfg.report = true;
+        else if (a == "--all-pairs") cfg.allPairs = true;
+        else if (a == "--delta") cfg.deltaPath = value();
+        else if (a == "--max-depth") cfg.approx.maxDepth = unsigned(std::stoul(value()));
+        else if (a == "--min-contrib") {
+            std::string w = trim(value());
+            const bool pct = !w.empty() && w.back() == '%';
+            if (pct) w.pop_back();
+            cfg.approx.minWeight = std::stod(w) / (pct ? 100.0 : 1.0);
+            if (!(cfg.approx.minWeight >= 0.0 && cfg.approx.minWeight < 1.0)) { std::cerr << "bad --min-contrib\n"; exit(1); }
+        }
+        else if (a == "--shards") cfg.shards = unsigned(std::stoul(value()));
+        else if (a == "--shard") {
+            if (!parseShardSpec(value(), cfg.shard)) { std::cerr << "bad --shard (I/N)\n"; exit(1); }
+        }
+        else if (a == "--inbreeding") cfg.inbreeding = true;
+        else if (a == "--kinship") cfg.kinRows = value();
+        else if (a == "--kin-with") cfg.kinCols = value();
+        else if (a == "--kin-sex") {
+            std::string v = value();
+            const size_t comma = v.find(',');
+            cfg.kinRowSex = trim(v.substr(0, comma));
+            cfg.kinColSex = comma == std::string::npos ? "" : trim(v.substr(comma + 1));
+        }
+        else { std::cerr << "unknown option: " << a << '\n'; exit(1); }
+    }
+    if (cfg.shard.active()) cfg.dbPath += "_shard" + std::to_string(cfg.shard.index);
+}
 
+//------------------------- 対象馬の解析 -------------------------------
+//  カンマ区切りの各要素 → targetPks (PrimaryKey 順) と idLabel
+//  要素は PrimaryKey そのもの、または target_index.h の式
+//  (年 / 年レンジ / year:… AND sire:… など)。結果は要素ごとの和集合
+//  "..." の中のカンマは区切りにしない
+void resolveTargets(const std::string& raw, std::vector<HorseId>& targetPks, std::string& idLabel)
+{
     /* ---------- 1. 文字列を解析して targetPks を作成 ---------- */
-    std::unordered_set<std::string> targetSet;
-    std::vector<std::string>        idTokens;
-
-    std::regex reRange(R"(^(\d{4})-(\d{4})$)");
-    std::regex reYear(R"(^(\d{4})$)");
+    if (!targetIndex.built()) targetIndex.build(ped);
+    HorseSet targetSet(ped.size());
+    std::vector<std::string> idTokens;
 
-    std::stringstream ss(raw);
-    for (std::string tok; std::getline(ss, tok, ','); ) {
+    std::vector<std::string> parts(1);
+    bool quoted = false;
+    for (char c : raw) {
+        if (c == '"') quoted = !quoted;
+        if (c == ',' && !quoted) parts.emplace_back();
+        else parts.back().push_back(c);
+    }
+    HorseSet part;
+    std::string err;
+    for (std::string tok : parts) {
         tok = trim(tok);
         if (tok.empty()) continue;
         idTokens.push_back(tok);
 
-        std::smatch m;
-        if (std::regex_match(tok, m, reRange)) {          // 年レンジ
-            int y1 = std::stoi(m[1]), y2 = std::stoi(m[2]);
-            if (y1 > y2) std::swap(y1, y2);
-            for (auto& kv : horses) {
-                int y = horses[kv.first].YearInt;
-                if (y >= y1 && y <= y2) targetSet.insert(kv.first);
-            }
-        }
-        else if (std::regex_match(tok, m, reYear)) {    // 単年
-            int y = std::stoi(tok);
-            for (auto& kv : horses)
-                if (horses[kv.first].YearInt == y)
-                    targetSet.insert(kv.first);
-        }
-        else {                                          // PrimaryKey
-            if (!horses.count(tok))
-                std::cerr << "PrimaryKey \"" << tok << "\" not found - skip\n";
-            else
-                targetSet.insert(tok);
-        }
+        const HorseId id = TargetIndex::isYearToken(tok) ? NO_HORSE : ped.find(tok);   // 式に見える PrimaryKey もそのまま
+        if (id != NO_HORSE) targetSet.insert(id);
+        else if (targetIndex.select(tok, part, err)) targetSet |= part;
+        else std::cerr << err << " - skip\n";
     }
 	std::cout << "[main] " << targetSet.size() << " targets found\n";
 
-    if (targetSet.empty()) { std::cerr << "対象馬が 0 頭でした。\n"; return 1; }
-
-    std::vector<std::string> targetPks(targetSet.begin(), targetSet.end());
-    std::sort(targetPks.begin(), targetPks.end());
+    // 列順は従来どおり PrimaryKey の辞書順
+    targetPks.assign(targetSet.begin(), targetSet.end());
+    std::sort(targetPks.begin(), targetPks.end(),
+        [](HorseId a, HorseId b) { return ped.key[a] < ped.key[b]; });
 
     /* ---------- 2. idLabel を生成 ---------- */
-    std::string idLabel;
+    idLabel.clear();
     for (size_t i = 0; i < idTokens.size(); ++i) {
         if (i) idLabel += "_";
         idLabel += idTokens[i];
     }
     std::replace_if(idLabel.begin(), idLabel.end(),
         [](char c) { return !std::isalnum((unsigned char)c); }, '_');
+    std::replace(idLabel.begin(), idLabel.end(), ' ', '_'); // 空白→_
+}
 
-    /* ---------- 3. 以降は従来ロジック（targetPks を使う） ---------- */
-    // ... allKeys 作成、setAnc / setDesc 収集、CSV 出力など
+//------------------------- 上位 K 頭 (--top) -------------------------------
+//  行列は作らず、対象馬ごとに
+//    carriers  : 対象馬の血を多く持つ子孫 K 頭 (topDescendants, 枝刈り付き)
+//    ancestors : 対象馬に血を多く与えた祖先 K 頭 (祖先ベクトル → 有界ヒープ)
+//  だけを書く。--top-year / --top-sex は結果側の馬に掛ける
+void runTopK(const std::vector<HorseId>& targetPks, const std::string& idLabel,
+    const std::string& outDir)
+{
+    const std::string k = std::to_string(cfg.topK);
+    const std::string fileA = outDir + "/top" + k + "_carriers_of_" + idLabel + approxSuffix(true) + ".csv";
+    const std::string fileB = outDir + "/top" + k + "_ancestors_of_" + idLabel + approxSuffix() + ".csv";
+    CsvOut carriers(fileA), ancestors(fileB);
+    if (!carriers.ok()) outputFailed(fileA, false);
+    if (!ancestors.ok()) outputFailed(fileB, false);
+    carriers.put("Target,Rank,HorseName,Blood\n");
+    ancestors.put("Target,Rank,HorseName,Blood\n");
 
-    // --- 全馬キー (年代順) ---
-    std::vector<std::string> allKeys;
-    allKeys.reserve(horses.size());
-    for (auto& kv : horses) allKeys.push_back(kv.first);
-    std::sort(allKeys.begin(), allKeys.end(),
-        [&](const std::string& a, const std::string& b) {
-            int ya = horses[a].YearInt, yb = horses[b].YearInt;
-            return (ya == yb) ? a < b : ya < yb;
-        });
+    auto write = [](CsvOut& o, HorseId t, const Ranked& r) {
+        for (size_t i = 0; i < r.size(); ++i)
+            o.put(ped.display[t]).put(',').put(std::to_string(i + 1)).put(',')
+             .put(ped.display[r[i].first]).put(',').putFixed(r[i].second).put('\n');
+    };
 
-    // --- 祖先・子孫セット（targets 全体の和集合） ---
-    std::unordered_set<std::string> setAnc, setDesc;
-    for (const auto& pk : targetPks) {
-        collectAncestors(pk, setAnc);
-        collectDescendants(pk, setDesc);
+    auto ph = report.phase("topk");
+    auto t0 = std::chrono::steady_clock::now();
+    TopKStats st;
+    Ranked r;
+    for (HorseId t : targetPks) {
+        // --- 子孫側 ---
+        if (ped.acyclic) topDescendants(ped, t, cfg.topK, cfg.topFilter, r, &st);
+        else {
+            TopKHeap heap(ped, cfg.topK);
+            HorseSet desc;
+            collectDescendants(t, desc);
+            for (HorseId d : desc) {
+                if (d == t || !cfg.topFilter.pass(ped, d)) continue;
+                std::unordered_set<HorseId> stk;
+                double v = getBlood(d, t, stk);
+                if (std::fabs(v) >= 1e-12) heap.offer(d, v);
+            }
+            heap.take(r);
+        }
+        write(carriers, t, r);
+
+        // --- 祖先側 ---
+        AncestryVec v;
+        if (ped.acyclic) ancestryOf(t, v);
+        else {
+            HorseSet anc;
+            collectAncestors(t, anc);
+            for (HorseId a : anc) {
+                std::unordered_set<HorseId> stk;
+                double b = getBlood(t, a, stk);
+                if (std::fabs(b) >= 1e-12) v.emplace_back(a, b);
+            }
+        }
+        topFromVector(ped, v, t, cfg.topK, cfg.topFilter, r);
+        write(ancestors, t, r);
     }
+    if (!carriers.close()) outputFailed(fileA);
+    if (!ancestors.close()) outputFailed(fileB);
+    std::cout << "[top] " << targetPks.size() << " targets, K=" << cfg.topK
+        << ", visited=" << st.visited << ", resolved=" << st.resolved << ", "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - t0).count() << " ms\n";
+    std::cout << "[done] " << fileA << '\n' << "[done] " << fileB << '\n';
+}
 
-    std::replace(idLabel.begin(), idLabel.end(), ' ', '_'); // 空白→_
+//------------------------- 1 クエリぶんの出力 -------------------------------
+//  File-A / File-B を outDir に書き出す
+//  問い合わせの出力ファイル名
+//    File-A = 対象馬の血が全馬に何 % 入っているか / File-B = 全馬の血が対象馬に何 % 入っているか
+//  近似モードの印は approxSuffix (File-A は循環が無ければ厳密値なので印無し)
+void queryFileNames(const std::string& outDir, const std::string& idLabel, std::string& fileA, std::string& fileB) {
+    fileA = matrixFileName(outDir + "/blood_of_" + idLabel + approxSuffix(true) + "_in_all_horses");
+    fileB = matrixFileName(outDir + "/blood_of_all_horses_in_" + idLabel + approxSuffix());
+}
 
-    // ==========================================================
-    // File-A  行 = 全馬, 列 = targets
-    // ==========================================================
-    std::string fileA = "D:/AI/C++/out/blood_of_" + idLabel + "_in_all_horses.csv";
-    // ==========================================================
-    // File-B  行 = targets, 列 = 全馬
-    // ==========================================================
-    std::string fileB = "D:/AI/C++/out/blood_of_all_horses_in_" + idLabel + ".csv";
+void runQuery(const std::vector<HorseId>& targetPks, const std::string& idLabel,
+    const std::string& outDir)
+{
+    approxStats.reset();
+    if (cfg.topK) { runTopK(targetPks, idLabel, outDir);  printApproxSummary();  return; }
+
+    // --- 全馬キー (年代順) ---
+    const std::vector<HorseId>& allKeys = ped.yearOrder;   // 読込時に整列済み
+
+    // --- 祖先・子孫セット（targets 全体の和集合。全起点から 1 回ずつ走査） ---
+    HorseSet setAnc, setDesc;
+    {
+        auto ph = report.phase("collect_sets");
+        ancestorsOf(ped, targetPks, setAnc);
+        descendantsOf(ped, targetPks, setDesc);
+    }
+
+    std::string fileA, fileB;
+    queryFileNames(outDir, idLabel, fileA, fileB);
 
     // ==========================================================
     // File-A  行 = 全馬, 列 = targets
     // ==========================================================
-    if (targetPks.size() == 1) {
+    //  1 列専用の書き出しは csv のみ。他形式は汎用関数 (列 1 本の行列) で
+    //  (--shard のワーカーは統合できる部分ファイルを書くので常に汎用関数)
+    const bool singleCsv = targetPks.size() == 1 && cfg.format == MatrixFormat::CSV && !cfg.gzip
+        && !cfg.shard.active();
+    auto phA = report.phase("file_a");
+    if (singleCsv) {
         // 進捗ログ付き・列 1 本
         saveDescFast(fileA, allKeys, setDesc, targetPks[0]);
     }
@@ -452,13 +1183,14 @@ int main() {
             [&](auto row, auto) { return setDesc.count(row); });
 
     }
+    phA.stop();
     std::cout << "[done] " << fileA << '\n';
-    dp.clear();
 
     // ==========================================================
     // File-B  行 = targets, 列 = 全馬
     // ==========================================================
-    if (targetPks.size() == 1) {
+    auto phB = report.phase("file_b");
+    if (singleCsv) {
         saveAncVert(fileB, allKeys, setAnc, targetPks[0]);
     }
     else {
@@ -469,11 +1201,635 @@ int main() {
 
     }
     std::cout << "[done] " << fileB << '\n';
+    printApproxSummary();
+}
+
+//------------------------- 複数プロセスでの分担 (--shards N) -------------------------------
+//  コマンドラインの 1 語を sh / cmd.exe 向けに囲む
+std::string shellQuote(const std::string& a) {
+#ifdef _WIN32
+    return "\"" + a + "\"";
+#else
+    std::string q = "'";
+    for (char c : a) { if (c == '\'') q += "'\\''"; else q += c; }
+    return q + "'";
+#endif
+}
+
+//  部分ファイル (全行 × 担当列) を行ごとに横につなぎ、単一プロセスと同じ書式で file に書く
+bool mergeMatrixParts(const std::string& file, const std::vector<HorseId>& rows,
+    const std::vector<HorseId>& cols, bool transpose)
+{
+    const unsigned n = cfg.shards;
+    std::vector<std::string> parts(n);
+    std::vector<std::pair<size_t, size_t>> spans(n);
+    for (unsigned i = 0; i < n; ++i) {
+        const ShardSpec sp{ i, n };
+        spans[i] = sp.range(cols.size());
+        parts[i] = shardPartPath(file, sp);
+        const std::vector<HorseId> slice(cols.begin() + spans[i].first, cols.begin() + spans[i].second);
+        if (!MatrixPart::complete(parts[i], rows.size(), slice.size(), shardSignature(rows, slice, transpose))) {
+            std::cerr << "[shards] " << parts[i] << " が完了していません\n";
+            return false;
+        }
+    }
+    CsvOut ofs(file, isBinaryFormat(cfg.format), cfg.gzip);
+    if (!ofs.ok()) { std::cerr << "cannot open " << file << '\n';  return false; }
+    if (!writeMatrixHead(ofs, file, rows, cols)) return false;
+
+    constexpr size_t ROW_CHUNK = 64;
+    const size_t total = rows.size(), chunks = (total + ROW_CHUNK - 1) / ROW_CHUNK;
+    WorkStealingPool pool(cfg.threads);
+    OrderedSink sink(chunks, 4 * pool.size());
+    sink.limit(governedWindow);
+    std::vector<std::vector<std::ifstream>> in(pool.size());
+    std::vector<std::vector<double>> vals(pool.size(), std::vector<double>(cols.size()));
+    std::atomic<bool> ok{ true };
+    std::thread compute([&] {
+        pool.run(chunks, [&](size_t c, unsigned w) {
+            if (in[w].empty()) for (const auto& p : parts) in[w].emplace_back(p, std::ios::binary);
+            std::string text;
+            for (size_t ri = c * ROW_CHUNK; ri < std::min(total, (c + 1) * ROW_CHUNK); ++ri) {
+                for (unsigned i = 0; i < n; ++i) {
+                    const size_t k = spans[i].second - spans[i].first;
+                    if (k && !MatrixPart::readRow(in[w][i], ri, k, vals[w].data() + spans[i].first)) ok = false;
+                }
+                appendMatrixRow(ri, rows[ri], vals[w], text);
+            }
+            sink.put(c, std::move(text));
+        });
+    });
+    sink.drain([&](size_t, const std::string& text) { ofs.put(text); });
+    compute.join();
+    const bool written = ofs.close();
+    // 統合した出力を書き切れたと分かるまで部分ファイルは消さない (再実行で統合だけやり直せる)
+    if (!ok || !written) {
+        std::cerr << "[shards] " << (ok ? "cannot write " : "部分ファイルを読めませんでした: ") << file
+            << " (部分ファイルは残しました)\n";
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+        return false;
+    }
+    for (const auto& p : parts) MatrixPart::remove(p);
+    return true;
+}
+
+//  自分自身を --shard I/N 付きで N 個起動し、全員が終わったら部分ファイルを統合する。
+//  問い合わせは DIR/shards_<label>/query.txt から標準入力で渡す。
+//  失敗したワーカーがあれば部分ファイルとチェックポイントを残して終わる (再実行で続きから)
+int runSharded(const std::string& raw, const std::vector<HorseId>& targetPks, const std::string& idLabel) {
+    const std::string label = idLabel + approxSuffix();
+    const std::string dir = cfg.outDir + "/shards_" + label;
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    {
+        std::ofstream q(dir + "/query.txt");
+        if (!(q << raw << '\n')) { std::cerr << "cannot write " << dir << "/query.txt\n";  return 1; }
+    }
+
+    std::cout << "[shards] " << targetPks.size() << " targets → " << cfg.shards << " workers\n";
+    std::vector<int> rc(cfg.shards, 0);
+    {
+        auto ph = report.phase("shard_workers");
+        std::vector<std::thread> th;
+        for (unsigned i = 0; i < cfg.shards; ++i)
+            th.emplace_back([&, i] {
+                std::string cmd;
+                for (const auto& a : cfg.args) cmd += shellQuote(a) + ' ';
+                cmd += "--shard " + std::to_string(i) + '/' + std::to_string(cfg.shards)
+                    + " < " + shellQuote(dir + "/query.txt")
+                    + " > " + shellQuote(dir + "/worker" + std::to_string(i) + ".log") + " 2>&1";
+#ifdef _WIN32
+                cmd = "\"" + cmd + "\"";      // cmd.exe /c は外側の引用符を 1 組外す
+#endif
+                rc[i] = std::system(cmd.c_str());
+            });
+        for (auto& t : th) t.join();
+    }
+    size_t failed = 0;
+    for (unsigned i = 0; i < cfg.shards; ++i)
+        if (rc[i]) {
+            ++failed;
+            std::cerr << "[shards] worker " << i << " failed (" << rc[i] << ") → " << dir << "/worker" << i << ".log\n";
+        }
+    if (failed) { std::cerr << "[shards] 同じコマンドを再実行すると、各ワーカーは続きから再開します\n";  return 1; }
+
+    auto ph = report.phase("shard_merge");
+    std::string fileA, fileB;
+    queryFileNames(cfg.outDir, idLabel, fileA, fileB);
+    if (!mergeMatrixParts(fileA, ped.yearOrder, targetPks, false)) return 1;
+    std::cout << "[done] " << fileA << '\n';
+    if (!mergeMatrixParts(fileB, ped.yearOrder, targetPks, true)) return 1;
+    std::cout << "[done] " << fileB << '\n';
+    std::filesystem::remove_all(dir, ec);
+    return 0;
+}
+
+//------------------------- 全馬 × 全馬 -------------------------------
+//  行 = 全馬, 列 = 全馬 (どちらも CSV の並び)。値 [行][列] = 列の馬の血が行の馬に何 % 入っているか
+//  行列本体は allpairs.h。ここでは行ブロックごとに読み戻して形式どおりに書くだけ
+template <class T>
+int writeAllPairs(const std::string& file) {
+    AllPairsOptions opt;
+    opt.f32 = std::is_same<T, float>::value;
+    opt.memMB = buildBudgetMB();
+    opt.threads = cfg.threads;
+    opt.spillPath = file + ".spill";
+    AllPairsMatrix<T> m(ped, opt);
+    AllPairsStats st;
+    {
+        auto ph = report.phase("allpairs_build");
+        if (!m.build(&st)) { std::cerr << "cannot write " << opt.spillPath << '\n';  return 1; }
+    }
+    std::cout << "[all-pairs] " << st.tiles << " tiles x " << st.tileCols << " cols"
+        << (st.spilled ? " (spill)" : "") << ", " << st.liveCells << " cells, "
+        << std::fixed << std::setprecision(3) << st.seconds << " s\n";
+    std::cout.unsetf(std::ios::floatfield);  std::cout << std::setprecision(6);
+    report.set("allpairs_tiles", st.tiles);
+    report.set("allpairs_cells", st.liveCells);
+
+    auto ph = report.phase("allpairs_write");
+    const size_t n = ped.size();
+    CsvOut ofs(file, isBinaryFormat(cfg.format), cfg.gzip);
+    if (!ofs.ok()) { std::cerr << "cannot open " << file << '\n';  return 1; }
+    std::string header;
+    if (cfg.format == MatrixFormat::CSV) {
+        header = "HorseName";
+        for (HorseId c = 0; c < n; ++c) header.append(",").append(ped.display[c]);
+        header.push_back('\n');
+    }
+    else {
+        for (const char* ext : { ".rows.txt", ".cols.txt" }) {
+            CsvOut lf(file + ext);
+            for (HorseId id = 0; id < n; ++id) lf.put(ped.display[id]).put('\n');
+            if (!lf.close()) { std::cerr << "cannot write " << file << ext << '\n';  return 1; }
+        }
+        matrixHeader(cfg.format, cfg.f32, n, n, header);
+    }
+    ofs.put(header);
+
+    // 1 チャンク = 行ブロック (作業領域 ≒ 32 MB / スレッド)
+    const size_t rowChunk = std::max<size_t>(1, (32u << 20) / (std::max<size_t>(1, n) * sizeof(double)));
+    const size_t chunks = (n + rowChunk - 1) / rowChunk;
+    WorkStealingPool pool(cfg.threads);
+    OrderedSink sink(chunks, 2 * pool.size());
+    sink.limit(governedWindow);
+    std::vector<typename AllPairsMatrix<T>::Reader> readers(pool.size());
+    std::vector<std::vector<double>> bufs(pool.size());
+    std::atomic<bool> ok{ true };
+    std::thread compute([&] {
+        pool.run(chunks, [&](size_t c, unsigned w) {
+            const size_t r0 = c * rowChunk, r1 = std::min(n, r0 + rowChunk);
+            std::vector<double>& v = bufs[w];
+            v.resize((r1 - r0) * n);
+            std::string text;
+            if (!m.readRows(r0, r1, v.data(), readers[w])) ok = false;
+            else for (size_t r = r0; r < r1; ++r) {
+                if (cfg.format == MatrixFormat::CSV) text.append(ped.display[r]);
+                matrixRow(cfg.format, cfg.f32, std::uint32_t(r), v.data() + (r - r0) * n, n, text);
+            }
+            sink.put(c, std::move(text));
+        });
+    });
+    Progress prog(cfg.progressMs, cfg.quiet);
+    sink.drain([&](size_t c, const std::string& text) {
+        const size_t last = std::min(n, (c + 1) * rowChunk);
+        if (prog.due(last, n)) std::cout << "[all-pairs] (" << last << '/' << n << ")\n";
+        ofs.put(text);
+    });
+    compute.join();
+    const bool written = ofs.close();
+    if (!ok) { std::cerr << "cannot read " << opt.spillPath << '\n';  return 1; }
+    if (!written) { std::cerr << "cannot write " << file << '\n';  return 1; }
+    std::cout << "[done] " << file << '\n';
+    return 0;
+}
+
+int runAllPairs(const std::string& outDir) {
+    if (!ped.acyclic) {
+        std::cerr << "[all-pairs] 血統に循環があるため全馬 × 全馬の行列は作れません\n";
+        return 1;
+    }
+    const std::string file = matrixFileName(outDir + "/blood_percentage");
+    return cfg.f32 ? writeAllPairs<float>(file) : writeAllPairs<double>(file);
+}
+
+//------------------------- 近交係数・kinship -------------------------------
+//  行 = rows, 列ラベル = colLabels の密行列を cfg.format で書く。
+//  fill(行番号, ワーカー番号, 値[列数]) を行チャンク単位で並列に呼ぶ
+//  開けない / 書き切れなければ false
+bool writeLabeledMatrix(const std::string& file, const std::vector<HorseId>& rows,
+    const std::vector<std::string>& colLabels,
+    const std::function<void(size_t, unsigned, double*)>& fill)
+{
+    CsvOut ofs(file, isBinaryFormat(cfg.format), cfg.gzip);
+    if (!ofs.ok()) { std::cerr << "cannot open " << file << '\n';  return false; }
+    std::string header;
+    if (cfg.format == MatrixFormat::CSV) {
+        header = "HorseName";
+        for (const auto& c : colLabels) header.append(",").append(c);
+        header.push_back('\n');
+    }
+    else {
+        CsvOut rf(file + ".rows.txt"), cf(file + ".cols.txt");
+        for (HorseId id : rows) rf.put(ped.display[id]).put('\n');
+        for (const auto& c : colLabels) cf.put(c).put('\n');
+        if (!rf.close() || !cf.close()) { std::cerr << "cannot write " << file << ".rows.txt / .cols.txt\n";  return false; }
+        matrixHeader(cfg.format, cfg.f32, rows.size(), colLabels.size(), header);
+    }
+    ofs.put(header);
+
+    constexpr size_t ROW_CHUNK = 64;
+    const size_t total = rows.size(), chunks = (total + ROW_CHUNK - 1) / ROW_CHUNK;
+    WorkStealingPool pool(cfg.threads);
+    OrderedSink sink(chunks, 4 * pool.size());
+    sink.limit(governedWindow);
+    std::vector<std::vector<double>> vals(pool.size(), std::vector<double>(colLabels.size()));
+    std::thread compute([&] {
+        pool.run(chunks, [&](size_t c, unsigned w) {
+            std::string text;
+            for (size_t i = c * ROW_CHUNK; i < std::min(total, (c + 1) * ROW_CHUNK); ++i) {
+                fill(i, w, vals[w].data());
+                if (cfg.format == MatrixFormat::CSV) text.append(ped.display[rows[i]]);
+                matrixRow(cfg.format, cfg.f32, std::uint32_t(i), vals[w].data(), vals[w].size(), text);
+            }
+            sink.put(c, std::move(text));
+        });
+    });
+    Progress prog(cfg.progressMs, cfg.quiet);
+    sink.drain([&](size_t c, const std::string& text) {
+        const size_t last = std::min(total, (c + 1) * ROW_CHUNK);
+        if (prog.due(last, total)) std::cout << "[kinship] (" << last << '/' << total << ")\n";
+        ofs.put(text);
+    });
+    compute.join();
+    if (!ofs.close()) { std::cerr << "cannot write " << file << '\n';  return false; }
+    std::cout << "[done] " << file << '\n';
+    return true;
+}
+
+//  --inbreeding / --kinship
+int runKinship(const std::string& outDir) {
+    if (!ped.acyclic) {
+        std::cerr << "[kinship] 血統に循環があるため近交係数は求められません\n";
+        return 1;
+    }
+    KinshipEngine kin(ped);
+    KinshipStats st;
+    {
+        auto ph = report.phase("inbreeding");
+        kin.computeInbreeding(cfg.threads, &st);
+    }
+    std::cout << "[kinship] F: " << st.horses << " horses, " << st.families << " families, "
+        << st.generations << " generations, max=" << st.maxF << ", mean=" << st.meanF
+        << ", " << std::fixed << std::setprecision(3) << st.seconds << " s\n";
+    std::cout.unsetf(std::ios::floatfield);  std::cout << std::setprecision(6);
+
+    if (cfg.inbreeding) {
+        const std::vector<double>& F = kin.inbreeding();
+        if (!writeLabeledMatrix(matrixFileName(outDir + "/inbreeding"), ped.yearOrder, { "F" },
+            [&](size_t i, unsigned, double* v) { v[0] = F[ped.yearOrder[i]]; })) return 1;
+    }
+    if (cfg.kinRows.empty()) return 0;
+
+    // --- 交配の組: 行 × 列 ---
+    auto side = [&](const std::string& q, const std::string& sex, std::vector<HorseId>& ids, std::string& label) {
+        resolveTargets(q, ids, label);
+        if (sex.empty()) return;
+        TopKFilter f;  f.sex = sex;
+        ids.erase(std::remove_if(ids.begin(), ids.end(), [&](HorseId h) { return !f.pass(ped, h); }), ids.end());
+    };
+    std::vector<HorseId> rows, cols;
+    std::string rowLabel, colLabel;
+    side(cfg.kinRows, cfg.kinRowSex, rows, rowLabel);
+    side(cfg.kinCols.empty() ? cfg.kinRows : cfg.kinCols, cfg.kinColSex, cols, colLabel);
+    if (rows.empty() || cols.empty()) { std::cerr << "[kinship] 対象馬が 0 頭でした\n";  return 1; }
+    std::cout << "[kinship] " << rows.size() << " x " << cols.size() << " pairs\n";
+
+    auto ph = report.phase("kinship");
+    std::vector<AncestryVec> rowVec, colVec;
+    ancestryVectors(rows, rowVec, true);
+    ancestryVectors(cols, colVec, true);
+    for (auto& v : colVec) kin.weightByD(v);
+
+    std::vector<std::string> colLabels;
+    for (HorseId c : cols) colLabels.push_back(ped.display[c]);
+    std::vector<std::vector<double>> dense(std::max(1u, cfg.threads), std::vector<double>(ped.size(), 0.0));
+    std::string label = rowLabel + (cfg.kinCols.empty() ? "" : "_x_" + colLabel);
+    const bool ok = writeLabeledMatrix(matrixFileName(outDir + "/kinship_" + label), rows, colLabels,
+        [&](size_t i, unsigned w, double* v) {
+            std::vector<double>& d = dense[w];
+            for (const auto& e : rowVec[i]) d[e.first] = e.second;
+            for (size_t j = 0; j < colVec.size(); ++j) v[j] = KinshipEngine::kinship(d, colVec[j]);
+            for (const auto& e : rowVec[i]) d[e.first] = 0.0;
+        });
+    return ok ? 0 : 1;
+}
+
+//------------------------- バッチ実行 -------------------------------
+//  ジョブファイル: 1 行 1 クエリ (対話入力と同じ書式)。空行と # 始まりは無視
+//  血統表・RocksDB・LRU は全ジョブで共有し、祖先を共有するジョブを隣接させて
+//  グループ単位でスイープ / 祖先ベクトルを 1 回だけ計算する (batch_plan.h)
+int runBatch(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) { std::cerr << "cannot open " << path << '\n'; return 1; }
+
+    auto phPlan = report.phase("batch_plan");
+    std::vector<BatchJob> jobs;
+    size_t failed = 0, lineNo = 0;
+    for (std::string line; std::getline(in, line); ) {
+        ++lineNo;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        BatchJob job;
+        job.query = line;  job.line = lineNo;
+        resolveTargets(line, job.targets, job.label);
+        if (job.targets.empty()) {
+            std::cerr << "[batch] line " << lineNo << ": 対象馬が 0 頭でした → skip\n";
+            ++failed;  continue;
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    // 1 グループで共有スイープできる列数 (File-A の上限と同じメモリ枠)
+    const size_t maxCols = std::max<size_t>(1,
+        buildBudgetMB() * 1024 * 1024 / (std::max<size_t>(1, ped.size()) * sizeof(double)));
+    const auto groups = batchplan::scheduleJobs(ped, jobs, maxCols);
+    phPlan.stop();
+    std::cout << "[batch] " << jobs.size() << " jobs, " << groups.size() << " groups\n";
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t doneJobs = 0;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        // --- グループ内の対象馬の和集合を 1 回だけ計算 ---
+        std::vector<HorseId> unionTargets;
+        {
+            std::unordered_set<HorseId> seen;
+            for (size_t j : groups[g])
+                for (HorseId t : jobs[j].targets)
+                    if (seen.insert(t).second) unionTargets.push_back(t);
+        }
+        if (ped.acyclic && groups[g].size() > 1 && !cfg.topK) {
+            auto ph = report.phase("batch_shared");
+            if (descBloodTableMB(ped, unionTargets.size()) <= buildBudgetMB()) {
+                sweepDescBlood(ped, unionTargets, shared.sweep, cfg.threads);
+                for (size_t c = 0; c < unionTargets.size(); ++c)
+                    shared.sweepCol.emplace(unionTargets[c], std::uint32_t(c));
+            }
+            std::vector<AncestryVec> vecs;
+            std::vector<double> bounds;
+            ancestryVectors(unionTargets, vecs, false, &bounds);
+            for (size_t c = 0; c < unionTargets.size(); ++c) {
+                shared.anc.emplace(unionTargets[c], std::move(vecs[c]));
+                if (!bounds.empty()) shared.ancBound.emplace(unionTargets[c], bounds[c]);
+            }
+        }
+        std::cout << "[batch] group " << g + 1 << '/' << groups.size() << ": "
+            << groups[g].size() << " jobs, " << unionTargets.size() << " targets\n";
+
+        for (size_t j : groups[g]) {
+            const BatchJob& job = jobs[j];
+            char num[16];
+            std::snprintf(num, sizeof num, "%04zu", job.line);
+            const std::string dir = cfg.outDir + "/" + num + "_" + job.label;
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if (ec) {
+                std::cerr << "[batch] cannot create " << dir << ": " << ec.message() << '\n';
+                ++failed;  continue;
+            }
+            std::cout << "[batch] (" << ++doneJobs << '/' << jobs.size() << ") line "
+                << job.line << ": " << job.query << '\n';
+            runQuery(job.targets, job.label, dir);
+        }
+        shared.clear();
+    }
+
+    std::cout << "[batch] " << doneJobs << " jobs done, " << failed << " failed, "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - t0).count() << " ms\n";
+    return failed ? 1 : 0;
+}
+
+//------------------------- 常駐サーバ -------------------------------
+//  血統表・LRU・RocksDB を常駐させたまま、1 行 1 要求で答える (query_server.h)
+//    BLOOD <子孫> <祖先>  → OK <血量>
+//    ANC   <馬> [N]       → OK <n> + n 行 "PrimaryKey<TAB>血量" (祖先。血量の降順で上位 N)
+//    DESC  <馬> [N]       → 同上 (子孫に含まれる <馬> の血量)
+//  馬は PrimaryKey で指定する。N 省略 / 0 は全件
+
+// 血量の降順 (同値は PrimaryKey 順) で上位 top 件を "OK n" 形式に
+void formatRanked(std::vector<std::pair<HorseId, double>>& v, size_t top, std::string& out) {
+    auto better = [](const std::pair<HorseId, double>& a, const std::pair<HorseId, double>& b) {
+        return a.second != b.second ? a.second > b.second : ped.key[a.first] < ped.key[b.first];
+    };
+    if (top == 0 || top > v.size()) top = v.size();
+    std::partial_sort(v.begin(), v.begin() + top, v.end(), better);
+    out.append("OK ").append(std::to_string(top)).push_back('\n');
+    for (size_t i = 0; i < top; ++i) {
+        out.append(ped.key[v[i].first]).push_back('\t');
+        appendShortest(out, v[i].second);
+        out.push_back('\n');
+    }
+}
+
+int runServer(const std::string& path) {
+    QueryServer srv;
+    auto horse = [](const std::string& pk, HorseId& id, std::string& err) {
+        id = ped.find(pk);
+        if (id == NO_HORSE) err = "unknown horse " + pk;
+        return id != NO_HORSE;
+    };
+    auto topArg = [](const std::vector<std::string>& tok, size_t& top, std::string& err) {
+        top = 0;
+        if (tok.size() < 3) return true;
+        char* end = nullptr;
+        top = std::strtoul(tok[2].c_str(), &end, 10);
+        if (*end) err = "bad count " + tok[2];
+        return !*end;
+    };
+
+    srv.route("BLOOD", [&](const std::vector<std::string>& tok, std::string& out) {
+        if (tok.size() != 3) { out = "usage: BLOOD <descendant> <ancestor>";  return false; }
+        HorseId tgt, anc;
+        if (!horse(tok[1], tgt, out) || !horse(tok[2], anc, out)) return false;
+        double v;
+        if (!ped.acyclic) {
+            std::unordered_set<HorseId> stk;
+            v = getBlood(tgt, anc, stk);
+        }
+        else if (!lru.get(BloodCache::makeKey(tgt, anc), v)) {
+            AncestryVec vec;
+            ancestryOf(tgt, vec);
+            v = ancestryGet(vec, anc);
+            lru.put(BloodCache::makeKey(tgt, anc), v);
+        }
+        out = "OK ";  appendShortest(out, v);  out.push_back('\n');
+        return true;
+    });
+
+    srv.route("ANC", [&](const std::vector<std::string>& tok, std::string& out) {
+        HorseId id;  size_t top;
+        if (tok.size() < 2) { out = "usage: ANC <horse> [N]";  return false; }
+        if (!horse(tok[1], id, out) || !topArg(tok, top, out)) return false;
+        AncestryVec v;
+        if (ped.acyclic) ancestryOf(id, v);
+        else {
+            HorseSet anc;
+            collectAncestors(id, anc);
+            for (HorseId a : anc) {
+                std::unordered_set<HorseId> stk;
+                v.emplace_back(a, getBlood(id, a, stk));
+            }
+        }
+        v.erase(std::remove_if(v.begin(), v.end(),
+            [&](const std::pair<HorseId, double>& e) { return e.first == id; }), v.end());
+        formatRanked(v, top, out);
+        return true;
+    });
+
+    srv.route("DESC", [&](const std::vector<std::string>& tok, std::string& out) {
+        HorseId id;  size_t top;
+        if (tok.size() < 2) { out = "usage: DESC <horse> [N]";  return false; }
+        if (!horse(tok[1], id, out) || !topArg(tok, top, out)) return false;
+        std::vector<std::pair<HorseId, double>> v;
+        if (ped.acyclic && top) {                        // 上位 N 頭だけなら枝刈り付きで
+            topDescendants(ped, id, top, TopKFilter(), v);
+            out.append("OK ").append(std::to_string(v.size())).push_back('\n');
+            for (const auto& e : v) {
+                out.append(ped.key[e.first]).push_back('\t');
+                appendShortest(out, e.second);
+                out.push_back('\n');
+            }
+            return true;
+        }
+        if (ped.acyclic) descendantVector(ped, id, v);
+        else {
+            HorseSet desc;
+            collectDescendants(id, desc);
+            for (HorseId d : desc) {
+                if (d == id) continue;
+                std::unordered_set<HorseId> stk;
+                v.emplace_back(d, getBlood(d, id, stk));
+            }
+        }
+        formatRanked(v, top, out);
+        return true;
+    });
+
+    if (!srv.listen(path)) { std::cerr << "cannot listen on " << path << '\n'; return 1; }
+    const unsigned workers = cfg.threads > 1 ? cfg.threads : std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "[serve] " << path << " で待ち受け中 (ワーカー " << workers << ", SHUTDOWN で終了)\n";
+    srv.run(workers, [] {
+        if (!ped.acyclic) return;
+        if (cfg.approx.enabled()) threadApproxEngine();
+        else threadEngine();
+    });
+    std::cout << "[serve] 終了\n" << srv.statsText();
+    return 0;
+}
+
+// =========================== main ===========================
+//  BLOODLINE_NO_MAIN を定義すると main を外す (ベンチマークが本体ごと取り込むため)
+#ifndef BLOODLINE_NO_MAIN
+int main(int argc, char** argv) {
+    parseArgs(argc, argv);
+    {   // 出力先 (無ければ作る。作れなければ何も計算せずに終わる)
+        std::error_code ec;
+        std::filesystem::create_directories(cfg.outDir, ec);
+        if (ec) { std::cerr << "cannot create " << cfg.outDir << ": " << ec.message() << '\n';  return 1; }
+    }
+    report.setup(getMemoryUsageMB, cfg.memBudgetMB ? cfg.memBudgetMB : MEMORY_THRESHOLD_MB, cfg.report);
+    lru.resize(cfg.cacheMB);
+    governor.start(getMemoryUsageMB, cfg.memBudgetMB, adaptToMemory);
+    {
+        auto ph = report.phase("load");
+        loadBloodlineCSV("bloodline.csv");
+    }
+    if (cfg.compile) return 0;
+
+    if (!cfg.deltaPath.empty()) {
+        int rc = runDelta("bloodline.csv", cfg.deltaPath);
+        writeRunReport(cfg.outDir + "/run_report_delta.json", "delta", cfg.deltaPath);
+        return rc;
+    }
+
+    if (cfg.allPairs) {
+        int rc = runAllPairs(cfg.outDir);
+        writeRunReport(cfg.outDir + "/run_report_all_pairs.json", "all-pairs", "");
+        return rc;
+    }
+
+    {
+        auto ph = report.phase("target_index");
+        targetIndex.build(ped);
+    }
+
+    if (cfg.inbreeding || !cfg.kinRows.empty()) {
+        store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat);   // 祖先ベクトルのキャッシュ
+        int rc = runKinship(cfg.outDir);
+        store.close();
+        writeRunReport(cfg.outDir + "/run_report_kinship.json", "kinship", cfg.kinRows);
+        return rc;
+    }
+
+    if (!cfg.batchPath.empty() || !cfg.servePath.empty()) {
+        {
+            auto ph = report.phase("store_open");
+            store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat);   // RocksDB を開く
+        }
+        int rc = cfg.servePath.empty() ? runBatch(cfg.batchPath) : runServer(cfg.servePath);
+        printCacheStats();
+        {
+            auto ph = report.phase("store_close");
+            store.close();
+        }
+        const bool batch = cfg.servePath.empty();
+        writeRunReport(cfg.outDir + (batch ? "/run_report_batch.json" : "/run_report_serve.json"),
+            batch ? "batch" : "serve", batch ? cfg.batchPath : cfg.servePath);
+        std::cout << "[main] すべて完了しました。\n";
+        return rc;
+    }
+
+    // --- 入力 ---
+    std::cout << "対象馬 (年/年レンジ/PrimaryKey/year:… AND sire:… などの式 をカンマ区切り): ";
+    std::string raw;  std::getline(std::cin, raw);
+
+    {
+        auto ph = report.phase("store_open");
+        store.open(cfg.dbPath, ped.fingerprint(), cfg.ancFloat);   // RocksDB を開く
+    }
+
+    std::vector<HorseId> targetPks;
+    std::string idLabel;
+    {
+        auto ph = report.phase("resolve_targets");
+        resolveTargets(raw, targetPks, idLabel);
+    }
+    if (targetPks.empty()) { std::cerr << "対象馬が 0 頭でした。\n"; return 1; }
+
+    if (cfg.shards > 1 && !cfg.shard.active()) {
+        if (cfg.topK || targetPks.size() < 2) std::cout << "[shards] 対象馬 1 頭 / --top は分担せずに実行します\n";
+        else {
+            int rc = runSharded(raw, targetPks, idLabel);
+            store.close();
+            writeRunReport(cfg.outDir + "/run_report_" + idLabel + ".json", "shards", raw);
+            if (!rc) std::cout << "[main] すべて完了しました。\n";
+            return rc;
+        }
+    }
+
+    runQuery(targetPks, idLabel, cfg.outDir);
 
     // --- 終了処理 ---
-    db->Flush(rocksdb::FlushOptions());
-    db.reset();
+    printCacheStats();
+    {
+        auto ph = report.phase("store_close");
+        store.close();
+    }
+    const std::string shardSuffix = cfg.shard.active() ? "_shard" + std::to_string(cfg.shard.index) : "";
+    writeRunReport(cfg.outDir + "/run_report_" + idLabel + shardSuffix + ".json", "query", raw);
     std::cout << "[main] すべて完了しました。\n";
     return 0;
 }
-
+#endif // BLOODLINE_NO_MAIN
@@ -0,0 +1,80 @@
+﻿#pragma once
+//====================================================================
+//  mapped_file.h  ―― 読み取り専用のメモリマップ (Windows / POSIX)
+//====================================================================
+#include <cstddef>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(hFile, &sz)) { close(); return false; }
+        len = size_t(sz.QuadPart);
+        if (len == 0) return true;
+        hMap = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!hMap) { close(); return false; }
+        ptr = static_cast<const char*>(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
+        if (!ptr) { close(); return false; }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { close(); return false; }
+        len = size_t(st.st_size);
+        if (len == 0) return true;
+        void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { close(); return false; }
+        madvise(p, len, MADV_SEQUENTIAL);
+        ptr = static_cast<const char*>(p);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (ptr) UnmapViewOfFile(ptr);
+        if (hMap) CloseHandle(hMap);
+        if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+        hMap = nullptr;  hFile = INVALID_HANDLE_VALUE;
+#else
+        if (ptr) munmap(const_cast<char*>(ptr), len);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        ptr = nullptr;  len = 0;
+    }
+
+    const char* data() const { return len ? ptr : ""; }     // 空のファイルは ""
+    size_t size() const { return len; }
+
+private:
+    const char* ptr = nullptr;
+    size_t len = 0;
+#ifdef _WIN32
+    HANDLE hFile = INVALID_HANDLE_VALUE, hMap = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,131 @@
+﻿#pragma once
+//====================================================================
+//  matrix_format.h  ―― 行列出力の形式 (--format)
+//
+//    csv     : 従来の密な CSV (ラベル付き)
+//    triplet : 0 でないセルだけを "row,col,value" で並べた CSV (値は往復で変わらない最短表記。
+//              遠い祖先の 5e-9 未満の値も 0.00000000 にならない)
+//    npy     : NumPy .npy (密、C 順、shape = (行, 列))
+//    bin     : 小さなヘッダ + 密な生配列 (行優先)
+//    sbin    : 小さなヘッダ + (row u32, col u32, value) の並び (0 でないセルのみ)
+//
+//    csv 以外は行・列のラベルを <出力>.rows.txt / .cols.txt に 1 行 1 頭で書く。
+//    値の型は --dtype f64 | f32 (csv は常に 8 桁、triplet は最短表記の文字列)。
+//
+//    bin / sbin ヘッダ (32B, little endian):
+//      char magic[8] = "BLDMAT01"; u32 kind (0=dense, 1=sparse);
+//      u32 dtype (8=f64, 4=f32); u64 rows; u64 cols
+//    sbin は書きながら流すのでセル数をヘッダに持たない。
+//    読む側は nnz = (ファイルの大きさ - 32) / (8 + dtype) で求める (gzip は展開後の大きさ)
+//====================================================================
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "output_writer.h"
+
+enum class MatrixFormat { CSV, TRIPLET, NPY, BIN, SBIN };
+
+inline bool parseMatrixFormat(const std::string& s, MatrixFormat& f) {
+    if (s == "csv") f = MatrixFormat::CSV;
+    else if (s == "triplet") f = MatrixFormat::TRIPLET;
+    else if (s == "npy") f = MatrixFormat::NPY;
+    else if (s == "bin") f = MatrixFormat::BIN;
+    else if (s == "sbin") f = MatrixFormat::SBIN;
+    else return false;
+    return true;
+}
+
+// ".csv" を置き換える拡張子
+inline const char* matrixExtension(MatrixFormat f) {
+    switch (f) {
+    case MatrixFormat::TRIPLET: return ".triplet.csv";
+    case MatrixFormat::NPY:     return ".npy";
+    case MatrixFormat::BIN:     return ".bin";
+    case MatrixFormat::SBIN:    return ".sbin";
+    default:                    return ".csv";
+    }
+}
+
+inline bool isBinaryFormat(MatrixFormat f) {
+    return f == MatrixFormat::NPY || f == MatrixFormat::BIN || f == MatrixFormat::SBIN;
+}
+
+//--------------------------------------------------------------------
+//  ファイル先頭 (ヘッダ)
+//--------------------------------------------------------------------
+inline void matrixHeader(MatrixFormat f, bool f32, std::uint64_t rows, std::uint64_t cols,
+    std::string& out)
+{
+    switch (f) {
+    case MatrixFormat::TRIPLET:
+        out += "row,col,value\n";
+        break;
+    case MatrixFormat::NPY: {
+        std::string dict = std::string("{'descr': '") + (f32 ? "<f4" : "<f8")
+            + "', 'fortran_order': False, 'shape': (" + std::to_string(rows) + ", "
+            + std::to_string(cols) + "), }";
+        // magic(6) + ver(2) + len(2) + dict + '\n' を 64B 境界に揃える
+        size_t total = 10 + dict.size() + 1;
+        dict.append((64 - total % 64) % 64, ' ');
+        dict.push_back('\n');
+        out.append("\x93NUMPY\x01\x00", 8);
+        out.push_back(char(dict.size() & 0xFF));
+        out.push_back(char(dict.size() >> 8));
+        out += dict;
+        break;
+    }
+    case MatrixFormat::BIN:
+    case MatrixFormat::SBIN: {
+        char h[32] = { 'B','L','D','M','A','T','0','1' };
+        std::uint32_t kind = (f == MatrixFormat::SBIN), dtype = f32 ? 4 : 8;
+        std::memcpy(h + 8, &kind, 4);
+        std::memcpy(h + 12, &dtype, 4);
+        std::memcpy(h + 16, &rows, 8);
+        std::memcpy(h + 24, &cols, 8);
+        out.append(h, sizeof h);
+        break;
+    }
+    default: break;   // csv のヘッダはラベル付きなので呼び出し側で作る
+    }
+}
+
+//--------------------------------------------------------------------
+//  1 行ぶん (csv のラベルは呼び出し側で付ける)
+//--------------------------------------------------------------------
+inline void appendValue(std::string& out, double v, bool f32) {
+    if (f32) { float x = float(v); out.append(reinterpret_cast<const char*>(&x), sizeof x); }
+    else out.append(reinterpret_cast<const char*>(&v), sizeof v);
+}
+
+inline void matrixRow(MatrixFormat f, bool f32, std::uint32_t row,
+    const double* v, size_t n, std::string& out)
+{
+    switch (f) {
+    case MatrixFormat::CSV:
+        for (size_t c = 0; c < n; ++c) { out.push_back(','); appendFixed(out, v[c]); }
+        out.push_back('\n');
+        break;
+    case MatrixFormat::TRIPLET:
+        for (size_t c = 0; c < n; ++c) {
+            if (v[c] == 0.0) continue;
+            out.append(std::to_string(row)).push_back(',');
+            out.append(std::to_string(c)).push_back(',');
+            appendShortest(out, v[c]);
+            out.push_back('\n');
+        }
+        break;
+    case MatrixFormat::NPY:
+    case MatrixFormat::BIN:
+        for (size_t c = 0; c < n; ++c) appendValue(out, v[c], f32);
+        break;
+    case MatrixFormat::SBIN:
+        for (size_t c = 0; c < n; ++c) {
+            if (v[c] == 0.0) continue;
+            std::uint32_t col = (std::uint32_t)c;
+            out.append(reinterpret_cast<const char*>(&row), 4);
+            out.append(reinterpret_cast<const char*>(&col), 4);
+            appendValue(out, v[c], f32);
+        }
+        break;
+    }
+}
@@ -0,0 +1,114 @@
+﻿#pragma once
+//====================================================================
+//  memory_governor.h  ―― RAM 予算の番人 (--mem-budget MB)
+//
+//    ・別スレッドで一定間隔に RSS を測り、予算に対する段階を決める
+//        NORMAL < 80 %  /  HIGH 80〜95 %  /  CRITICAL ≥ 95 %
+//      段階が変わったとき、および HIGH 以上の間は測るたびに handler を呼ぶ
+//      (キャッシュ段の伸縮は呼び出し側の handler が行う)
+//    ・fits(mb)  : これから mb を常駐させても HIGH 未満に収まるか
+//                  (大きな表を作る前に、メモリに置くかスピルするかを決める)
+//    ・window(n) : 書き出し待ちチャンクの上限。NORMAL = n, HIGH = n/2, CRITICAL = 1
+//    予算 0 (既定) なら無効: fits は常に true、window は n のまま
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class MemoryGovernor {
+public:
+    enum Level { NORMAL = 0, HIGH = 1, CRITICAL = 2 };
+    using MemProbe = size_t(*)();
+    using Handler = std::function<void(Level, size_t)>;   // (段階, RSS MB)
+
+    static constexpr double HIGH_RATIO = 0.80;
+    static constexpr double CRITICAL_RATIO = 0.95;
+
+    MemoryGovernor() = default;
+    MemoryGovernor(const MemoryGovernor&) = delete;
+    MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+    ~MemoryGovernor() { stop(); }
+
+    void start(MemProbe p, size_t budgetMB, Handler h, unsigned sampleMs = 200) {
+        if (!p || !budgetMB) return;
+        probe = p;  budget = budgetMB;  handler = std::move(h);
+        sampleNow();
+        stopping = false;
+        sampler = std::thread([this, sampleMs] {
+            std::unique_lock<std::mutex> lk(waitMu);
+            while (!waitCv.wait_for(lk, std::chrono::milliseconds(sampleMs), [&] { return stopping; })) {
+                lk.unlock();
+                sampleNow();
+                lk.lock();
+            }
+        });
+    }
+
+    void stop() {
+        if (!sampler.joinable()) return;
+        {
+            std::lock_guard<std::mutex> g(waitMu);
+            stopping = true;
+        }
+        waitCv.notify_all();
+        sampler.join();
+    }
+
+    bool   enabled() const { return budget > 0; }
+    size_t budgetMB() const { return budget; }
+    size_t rssMB() const { return rss.load(std::memory_order_relaxed); }
+    size_t peakMB() const { return peak.load(std::memory_order_relaxed); }
+    Level  level() const { return Level(lv.load(std::memory_order_relaxed)); }
+
+    //  HIGH の境目までの空き (MB)
+    size_t headroomMB() const {
+        const size_t high = size_t(double(budget) * HIGH_RATIO), now = rssMB();
+        return now < high ? high - now : 0;
+    }
+    bool fits(size_t mb) const { return !enabled() || mb <= headroomMB(); }
+
+    size_t window(size_t n) const {
+        switch (level()) {
+        case HIGH:     return std::max<size_t>(1, n / 2);
+        case CRITICAL: return 1;
+        default:       return n;
+        }
+    }
+
+    //  今すぐ測る (大きな確保の直前など、標本化の間隔を待てないとき)
+    void sampleNow() {
+        if (!enabled()) return;
+        std::lock_guard<std::mutex> g(sampleMu);
+        const size_t mb = probe();
+        rss = mb;
+        if (mb > peak) peak = mb;
+        const Level now = mb >= size_t(double(budget) * CRITICAL_RATIO) ? CRITICAL
+                        : mb >= size_t(double(budget) * HIGH_RATIO) ? HIGH : NORMAL;
+        const Level prev = Level(lv.exchange(now));
+        if (now != prev && now != NORMAL) ++(now == HIGH ? highEvents : criticalEvents);
+        if (handler && (now != prev || now != NORMAL)) handler(now, mb);
+    }
+
+    std::uint64_t highCount() const { return highEvents; }
+    std::uint64_t criticalCount() const { return criticalEvents; }
+
+private:
+    MemProbe probe = nullptr;
+    size_t   budget = 0;
+    Handler  handler;
+
+    std::mutex sampleMu;                 // sampleNow は標本化スレッドと呼び出し側の両方から
+    std::atomic<size_t> rss{ 0 }, peak{ 0 };
+    std::atomic<int> lv{ NORMAL };
+    std::atomic<std::uint64_t> highEvents{ 0 }, criticalEvents{ 0 };
+
+    std::thread sampler;
+    std::mutex waitMu;
+    std::condition_variable waitCv;
+    bool stopping = false;
+};
@@ -0,0 +1,169 @@
+﻿#pragma once
+//====================================================================
+//  output_writer.h  ―― 結果 CSV の書き出し段
+//
+//    ・CsvOut      : 大きな再利用バッファに追記し、満杯になったら裏スレッドへ
+//                    渡して fwrite (計算と書き込みを重ねる)。書き込みの失敗は覚えておき、
+//                    close() が false を返す (ディスク満杯などで欠けたファイルを成功扱いしない)
+//    ・appendFixed : std::to_chars による固定小数点 (ostream の
+//                    std::fixed << setprecision(n) と同じ文字列)
+//    ・appendShortest : 往復で値が変わらない最短表記 (問い合わせサーバの応答用)
+//    ・Progress    : 進捗ログを一定間隔 (と最終行) だけに間引く
+//
+//    BLOODLINE_WITH_ZLIB を定義してビルドすると gzip で書ける (--gzip)
+//====================================================================
+#include <charconv>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#ifdef BLOODLINE_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+inline void appendFixed(std::string& s, double v, int prec = 8) {
+    char buf[64];
+    auto r = std::to_chars(buf, buf + sizeof buf, v, std::chars_format::fixed, prec);
+    s.append(buf, r.ptr);
+}
+inline void appendShortest(std::string& s, double v) {
+    char buf[32];
+    auto r = std::to_chars(buf, buf + sizeof buf, v);
+    s.append(buf, r.ptr);
+}
+
+class CsvOut {
+public:
+    static constexpr size_t BUF_BYTES = 4 << 20;
+    static constexpr size_t MAX_PENDING = 4;         // 書き込み待ちバッファの上限
+
+    // 既定はテキストモード (Windows の改行変換は従来の ofstream と同じ)
+    //  binary = true で改行変換なし、gzip = true で gzip ストリーム
+    explicit CsvOut(const std::string& path, bool binary = false, bool gzip = false) {
+        (void)gzip;
+#ifdef BLOODLINE_WITH_ZLIB
+        if (gzip) gz = gzopen(path.c_str(), "wb6");
+        else
+#endif
+        fp = std::fopen(path.c_str(), binary ? "wb" : "w");
+        if (!ok()) return;
+        opened = true;
+        cur.reserve(BUF_BYTES);
+        writer = std::thread([this] { writerLoop(); });
+    }
+    CsvOut(const CsvOut&) = delete;
+    CsvOut& operator=(const CsvOut&) = delete;
+    ~CsvOut() { close(); }
+
+    bool ok() const {
+#ifdef BLOODLINE_WITH_ZLIB
+        if (gz) return true;
+#endif
+        return fp != nullptr;
+    }
+
+    static bool gzipAvailable() {
+#ifdef BLOODLINE_WITH_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    CsvOut& put(std::string_view s) { cur.append(s.data(), s.size()); spill(); return *this; }
+    CsvOut& put(char c) { cur.push_back(c); spill(); return *this; }
+    CsvOut& putFixed(double v, int prec = 8) { appendFixed(cur, v, prec); spill(); return *this; }
+
+    //  書き切って閉じる。開けなかった / 途中で書けなかったなら false (2 回目以降も同じ結果)
+    bool close() {
+        if (!ok()) return opened && !failed;
+        handOff();
+        {
+            std::lock_guard<std::mutex> g(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+#ifdef BLOODLINE_WITH_ZLIB
+        if (gz) { if (gzclose(gz) != Z_OK) failed = true;  gz = nullptr; }
+#endif
+        if (fp) { if (std::fclose(fp) != 0) failed = true;  fp = nullptr; }
+        return !failed;
+    }
+
+private:
+    void spill() { if (cur.size() >= BUF_BYTES) handOff(); }
+
+    void handOff() {
+        if (!ok()) { cur.clear(); return; }        // 開けなかったファイルへの書き込みは捨てる
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return pending.size() < MAX_PENDING; });
+        pending.emplace_back(std::move(cur));
+        if (!spare.empty()) { cur = std::move(spare.back()); spare.pop_back(); }
+        else cur = std::string();
+        cur.clear();  cur.reserve(BUF_BYTES);
+        cv.notify_all();
+    }
+
+    void writerLoop() {
+        std::unique_lock<std::mutex> lk(mu);
+        for (;;) {
+            cv.wait(lk, [&] { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+            std::string b = std::move(pending.front());
+            pending.pop_front();
+            lk.unlock();
+            if (!failed && !b.empty()) {            // 一度失敗したら以降は書かない
+#ifdef BLOODLINE_WITH_ZLIB
+                if (gz) failed = gzwrite(gz, b.data(), unsigned(b.size())) != int(b.size());
+                else
+#endif
+                failed = std::fwrite(b.data(), 1, b.size(), fp) != b.size();
+            }
+            lk.lock();
+            spare.push_back(std::move(b));
+            cv.notify_all();
+        }
+    }
+
+    std::FILE* fp = nullptr;
+#ifdef BLOODLINE_WITH_ZLIB
+    gzFile gz = nullptr;
+#endif
+    std::string cur;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::string> pending;
+    std::vector<std::string> spare;
+    std::thread writer;
+    bool stopping = false;
+    bool opened = false;
+    std::atomic<bool> failed{ false };
+};
+
+//  due(i, total) が true の時だけ進捗を出す (quiet なら最終行も出さない)
+class Progress {
+public:
+    Progress(unsigned intervalMs, bool quiet)
+        : interval(std::chrono::milliseconds(intervalMs)), quiet(quiet),
+          last(std::chrono::steady_clock::now() - interval) {}
+
+    bool due(size_t idx, size_t total) {
+        if (quiet) return false;
+        auto now = std::chrono::steady_clock::now();
+        if (idx != total && now - last < interval) return false;
+        last = now;
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::duration interval;
+    bool quiet;
+    std::chrono::steady_clock::time_point last;
+};
@@ -0,0 +1,107 @@
+﻿#pragma once
+//====================================================================
+//  parallel.h  ―― ワークスティーリング方式のタスク実行 + 順序付き書き出し
+//
+//    ・タスク番号 0..count-1 を各ワーカーの deque に交互に配る
+//    ・自分の deque は前 (小さい番号) から取り、空になったら
+//      他のワーカーの後ろ (大きい番号) から盗む
+//    ・OrderedSink: 完成したチャンクを番号順に 1 本の出力へ流す
+//      書き出し待ちは window 個まで。limit() で実行中に絞れる (メモリ番人)
+//====================================================================
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned n) : nThreads(std::max(1u, n)) {}
+
+    unsigned size() const { return nThreads; }
+
+    //  fn(task, worker) を全タスクについて実行し、全部終わるまで待つ
+    void run(size_t count, const std::function<void(size_t, unsigned)>& fn) {
+        if (nThreads == 1) { for (size_t t = 0; t < count; ++t) fn(t, 0); return; }
+
+        std::vector<Queue> qs(nThreads);
+        for (size_t t = 0; t < count; ++t) qs[t % nThreads].tasks.push_back(t);
+
+        auto worker = [&](unsigned w) {
+            size_t task;
+            while (popOwn(qs[w], task) || steal(qs, w, task)) fn(task, w);
+        };
+        std::vector<std::thread> th;
+        for (unsigned w = 1; w < nThreads; ++w) th.emplace_back(worker, w);
+        worker(0);
+        for (auto& t : th) t.join();
+    }
+
+private:
+    struct Queue { std::mutex mu; std::deque<size_t> tasks; };
+
+    static bool popOwn(Queue& q, size_t& task) {
+        std::lock_guard<std::mutex> g(q.mu);
+        if (q.tasks.empty()) return false;
+        task = q.tasks.front();  q.tasks.pop_front();
+        return true;
+    }
+    bool steal(std::vector<Queue>& qs, unsigned self, size_t& task) {
+        for (unsigned i = 1; i < nThreads; ++i) {
+            Queue& q = qs[(self + i) % nThreads];
+            std::lock_guard<std::mutex> g(q.mu);
+            if (q.tasks.empty()) continue;
+            task = q.tasks.back();  q.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    unsigned nThreads;
+};
+
+//  チャンク番号順に write(chunk, text) を呼ぶ単一の書き出し段
+//    put() はワーカーから、drain() は書き出し担当スレッドから呼ぶ。
+//    window を超えて先のチャンクを put しようとしたワーカーは待たされる
+class OrderedSink {
+public:
+    OrderedSink(size_t chunks, size_t window) : slots(chunks), ready(chunks, 0), window(window) {}
+
+    void put(size_t chunk, std::string&& text) {
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return chunk < next + (limiter ? std::max<size_t>(1, limiter(window)) : window); });
+        slots[chunk] = std::move(text);  ready[chunk] = 1;
+        cv.notify_all();
+    }
+
+    //  f(window) = 今の上限。待っている側は次のチャンクが書き出されたときに見直す
+    void limit(std::function<size_t(size_t)> f) { limiter = std::move(f); }
+
+    void drain(const std::function<void(size_t, const std::string&)>& write) {
+        for (size_t c = 0; c < slots.size(); ++c) {
+            std::string text;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return ready[c] != 0; });
+                text.swap(slots[c]);
+            }
+            write(c, text);
+            {
+                std::lock_guard<std::mutex> g(mu);
+                next = c + 1;
+            }
+            cv.notify_all();
+        }
+    }
+
+private:
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<std::string> slots;
+    std::vector<char> ready;
+    size_t next = 0, window;
+    std::function<size_t(size_t)> limiter;
+};
@@ -0,0 +1,140 @@
+﻿#pragma once
+//====================================================================
+//  pedigree.h  ―― 血統表 (整数 ID 版)
+//    ・PrimaryKey は読込時に 0..N-1 の連番 ID へ変換
+//    ・父 / 母 は ID の並列配列、親→子 は CSR (offset + 平坦配列)
+//    ・文字列は出力直前 (表示名 / RocksDB キー) でのみ使う
+//====================================================================
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using HorseId = std::uint32_t;
+constexpr HorseId NO_HORSE = std::numeric_limits<HorseId>::max();   // 不明・未登録の親
+
+static const std::string UNKNOWN_SIRE = "UNKNOWN_SIRE";   // 空欄の父・母の扱い
+static const std::string UNKNOWN_DAM = "UNKNOWN_DAM";
+
+struct Pedigree {
+    //---------------- ID → 属性 (並列配列) ----------------
+    std::vector<std::string> key;        // PrimaryKey
+    std::vector<std::string> name;       // Horse Name
+    std::vector<std::string> yearStr;
+    std::vector<int>         year;
+    std::vector<std::string> sex;        // Sex 列 (そのままの文字列)
+    std::vector<std::string> display;    // "名前 [年]"
+    std::vector<HorseId>     sire, dam;  // NO_HORSE = 不明
+
+    //---------------- 親 → 子 (CSR) ----------------
+    std::vector<std::uint32_t> childBegin;   // size() + 1 個
+    std::vector<HorseId>       childList;
+
+    std::unordered_map<std::string, HorseId> idOf;   // PrimaryKey → ID
+
+    //---------------- トポロジカル順 (親が必ず子より前) ----------------
+    std::vector<HorseId>       topo;         // 循環が無いときのみ全頭を含む
+    std::vector<std::uint32_t> topoPos;      // ID → topo 内の位置
+    bool acyclic = false;
+
+    //---------------- 年代順 (年 → PrimaryKey) 出力の行順 ----------------
+    std::vector<HorseId>       yearOrder;
+
+    size_t size() const { return key.size(); }
+
+    // 血統表の指紋 (FNV-1a over PrimaryKey と父母 ID)。ID の意味が変わると値も変わる
+    std::uint64_t fingerprint() const {
+        std::uint64_t h = 1469598103934665603ULL;
+        auto mix = [&](const void* p, size_t n) {
+            auto b = static_cast<const unsigned char*>(p);
+            for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 1099511628211ULL; }
+        };
+        for (size_t i = 0; i < size(); ++i) {
+            mix(key[i].data(), key[i].size() + 1);      // 終端 '\0' も区切りとして混ぜる
+            mix(&sire[i], sizeof(HorseId));
+            mix(&dam[i], sizeof(HorseId));
+        }
+        return h;
+    }
+
+    HorseId find(const std::string& pk) const {
+        auto it = idOf.find(pk);
+        return it == idOf.end() ? NO_HORSE : it->second;
+    }
+
+    // 子の範囲 [first, last)
+    const HorseId* childrenBegin(HorseId id) const { return childList.data() + childBegin[id]; }
+    const HorseId* childrenEnd(HorseId id)   const { return childList.data() + childBegin[id + 1]; }
+
+    // 新しい PrimaryKey を登録 (既存なら同じ ID を返す)
+    HorseId intern(const std::string& pk) {
+        auto it = idOf.find(pk);
+        if (it != idOf.end()) return it->second;
+        HorseId id = (HorseId)key.size();
+        idOf.emplace(pk, id);
+        key.push_back(pk);
+        name.emplace_back();  yearStr.emplace_back();  sex.emplace_back();  display.emplace_back();
+        year.push_back(INT_MIN);
+        sire.push_back(NO_HORSE);  dam.push_back(NO_HORSE);
+        return id;
+    }
+
+    // sire / dam から CSR を組み直す (計数 → 累積和 → 充填 の 2 パス)
+    void buildChildren() {
+        const size_t n = size();
+        childBegin.assign(n + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            if (sire[i] != NO_HORSE) ++childBegin[sire[i] + 1];
+            if (dam[i] != NO_HORSE)  ++childBegin[dam[i] + 1];
+        }
+        for (size_t i = 0; i < n; ++i) childBegin[i + 1] += childBegin[i];
+        childList.resize(childBegin[n]);
+        std::vector<std::uint32_t> pos(childBegin.begin(), childBegin.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            if (sire[i] != NO_HORSE) childList[pos[sire[i]]++] = (HorseId)i;
+            if (dam[i] != NO_HORSE)  childList[pos[dam[i]]++] = (HorseId)i;
+        }
+    }
+
+    void buildYearOrder() {
+        yearOrder.resize(size());
+        for (HorseId id = 0; id < size(); ++id) yearOrder[id] = id;
+        std::sort(yearOrder.begin(), yearOrder.end(), [&](HorseId a, HorseId b) {
+            return (year[a] == year[b]) ? key[a] < key[b] : year[a] < year[b];
+        });
+    }
+
+    // Kahn 法でトポロジカル順を作る。循環があれば false (topo は途中まで)
+    //  ※ buildChildren() の後に呼ぶこと
+    bool buildTopoOrder() {
+        const size_t n = size();
+        std::vector<std::uint8_t> indeg(n, 0);
+        for (size_t i = 0; i < n; ++i)
+            indeg[i] = std::uint8_t((sire[i] != NO_HORSE) + (dam[i] != NO_HORSE));
+        topo.clear();  topo.reserve(n);
+        for (size_t i = 0; i < n; ++i) if (!indeg[i]) topo.push_back((HorseId)i);
+        for (size_t h = 0; h < topo.size(); ++h)
+            for (const HorseId* c = childrenBegin(topo[h]); c != childrenEnd(topo[h]); ++c)
+                if (--indeg[*c] == 0) topo.push_back(*c);
+        topoPos.assign(n, std::uint32_t(-1));
+        for (size_t p = 0; p < topo.size(); ++p) topoPos[topo[p]] = (std::uint32_t)p;
+        acyclic = (topo.size() == n);
+        return acyclic;
+    }
+};
+
+//  topo 順を世代 (基礎馬 = 0, 子 = max(父, 母) + 1) で安定整列した処理順。
+//  gen を渡すと各馬の世代も返す。※ ped.acyclic == true が前提
+inline std::vector<HorseId> generationOrder(const Pedigree& ped, std::vector<std::uint32_t>* genOut = nullptr) {
+    std::vector<std::uint32_t> gen(ped.size(), 0);
+    for (HorseId h : ped.topo)
+        for (HorseId p : { ped.sire[h], ped.dam[h] })
+            if (p != NO_HORSE) gen[h] = std::max(gen[h], gen[p] + 1);
+    std::vector<HorseId> order(ped.topo.begin(), ped.topo.end());
+    std::stable_sort(order.begin(), order.end(), [&](HorseId a, HorseId b) { return gen[a] < gen[b]; });
+    if (genOut) genOut->swap(gen);
+    return order;
+}
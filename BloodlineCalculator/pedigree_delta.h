@@ -0,0 +1,137 @@
+﻿#pragma once
+//====================================================================
+//  pedigree_delta.h  ―― 血統表の差分取込 (新しい馬の追加と父母の訂正)
+//
+//    ・入力は bloodline.csv と同じ列構成の CSV (ヘッダ 1 行)。全体の新版でも
+//      追加・訂正した行だけの差分ファイルでもよい
+//    ・既存の馬の ID は変えない。新しい馬は末尾に ID を振る
+//      (bloodline.csv の末尾に行を書き足せば、読み直しても同じ ID になる)
+//    ・使う列 (父・母・Sex・年・名前) が同じ行は無視。行の削除は扱わない
+//    ・追加した馬が、既存の行で「未登録の親」として書かれていた場合は
+//      元の CSV を 1 回なめて親をつなぎ直す (読み直したときと同じ結果にするため)
+//    ・父母が変わった馬の子孫 (自身を含む) だけが血量の再計算対象
+//      (tgt の祖先の父母が変わっていなければ、tgt の血量はどれも変わらない)
+//====================================================================
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "closure.h"
+#include "csv_loader.h"
+#include "mapped_file.h"
+#include "pedigree.h"
+
+struct PedigreeDelta {
+    std::vector<HorseId> added;        // 新しい馬
+    std::vector<HorseId> reparented;   // 父か母が変わった既存の馬 (ID 昇順)
+    std::vector<HorseId> affected;     // 再計算が必要な馬 = reparented の子孫 (ID 昇順)
+    std::string appendText;            // bloodline.csv の末尾に足す行
+    size_t rows = 0, relinked = 0, attrOnly = 0;
+    double seconds = 0;
+};
+
+namespace pdelta {
+
+inline HorseId resolveParent(const Pedigree& ped, std::string_view pk, const std::string& unknown) {
+    return pk.empty() ? ped.find(unknown) : ped.find(std::string(pk));
+}
+
+//  CSV の各データ行 (ヘッダを除く) を fn(row, 行の文字列) に渡す
+template <class Fn>
+bool forEachRow(const std::string& path, Fn&& fn) {
+    MappedFile mf;
+    if (!mf.open(path)) return false;
+    const char* b = mf.data();
+    const char* e = b + mf.size();
+    const char* nl = static_cast<const char*>(std::memchr(b, '\n', mf.size()));
+    b = nl ? nl + 1 : e;
+    std::deque<std::string> owned;
+    while (b < e) {
+        nl = static_cast<const char*>(std::memchr(b, '\n', size_t(e - b)));
+        const char* le = nl ? nl : e;
+        csvload::Row r;
+        if (le != b && csvload::parseLine(b, le, r, owned)) fn(r, std::string_view(b, size_t(le - b)));
+        owned.clear();
+        b = nl ? nl + 1 : e;
+    }
+    return true;
+}
+
+} // namespace pdelta
+
+//  deltaPath の行を ped に反映する。basePath = ped の読込元 CSV (つなぎ直しの確認用)
+//  ped の CSR / topo / 年代順も作り直す
+inline bool applyPedigreeDelta(Pedigree& ped, const std::string& deltaPath, const std::string& basePath,
+    PedigreeDelta& d)
+{
+    using namespace pdelta;
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t oldN = ped.size();
+    const std::vector<HorseId> oldSire = ped.sire, oldDam = ped.dam;
+
+    // 1) 行を読む。新しい PrimaryKey は先に全部登録する (同じ差分内の親子に備えて)
+    struct Line { std::string pk, sire, dam, sex, year, name, text; };
+    std::vector<Line> lines;
+    if (!forEachRow(deltaPath, [&](const csvload::Row& r, std::string_view text) {
+            lines.push_back({ std::string(r.pk), std::string(r.sire), std::string(r.dam),
+                std::string(r.sex), std::string(r.year), std::string(r.name), std::string(text) });
+        })) return false;
+    d.rows = lines.size();
+    for (const Line& l : lines)
+        if (ped.find(l.pk) == NO_HORSE) d.added.push_back(ped.intern(l.pk));
+
+    // 2) 父母と属性を反映。使う列が変わった行だけを書き足し対象にする (後の行が優先)
+    for (const Line& l : lines) {
+        const HorseId id = ped.find(l.pk);
+        const HorseId s = resolveParent(ped, l.sire, UNKNOWN_SIRE), m = resolveParent(ped, l.dam, UNKNOWN_DAM);
+        const bool isNew = id >= oldN && ped.display[id].empty();
+        const bool parents = s != ped.sire[id] || m != ped.dam[id];
+        const bool attrs = l.sex != ped.sex[id] || l.year != ped.yearStr[id] || l.name != ped.name[id];
+        if (!isNew && !parents && !attrs) continue;
+        if (!isNew && !parents) ++d.attrOnly;
+        ped.sire[id] = s;  ped.dam[id] = m;
+        ped.sex[id] = l.sex;  ped.yearStr[id] = l.year;  ped.name[id] = l.name;
+        ped.year[id] = csvload::parseYear(l.year);
+        ped.display[id].assign(l.name).append(" [").append(l.year).append("]");
+        d.appendText.append(l.text).push_back('\n');
+    }
+
+    // 3) 追加した馬を「未登録の親」として書いていた既存の行をつなぎ直す
+    //    (重複した PrimaryKey は最後の行が有効。差分に含まれる馬は 2) が優先)
+    if (!d.added.empty()) {
+        std::unordered_set<std::string_view> addedPk;
+        for (HorseId id : d.added) addedPk.insert(ped.key[id]);
+        std::unordered_set<std::string_view> inDelta;
+        for (const Line& l : lines) inDelta.insert(l.pk);
+        std::unordered_map<HorseId, std::pair<HorseId, HorseId>> relink;
+        if (!forEachRow(basePath, [&](const csvload::Row& r, std::string_view) {
+                if (inDelta.count(r.pk)) return;
+                const HorseId id = ped.find(std::string(r.pk));
+                if (id == NO_HORSE) return;
+                if (addedPk.count(r.sire) || addedPk.count(r.dam))
+                    relink[id] = { resolveParent(ped, r.sire, UNKNOWN_SIRE), resolveParent(ped, r.dam, UNKNOWN_DAM) };
+                else relink.erase(id);
+            })) return false;
+        for (const auto& kv : relink) {
+            ped.sire[kv.first] = kv.second.first;  ped.dam[kv.first] = kv.second.second;
+            ++d.relinked;
+        }
+    }
+
+    for (HorseId id = 0; id < oldN; ++id)
+        if (ped.sire[id] != oldSire[id] || ped.dam[id] != oldDam[id]) d.reparented.push_back(id);
+
+    ped.buildChildren();
+    ped.buildTopoOrder();
+    ped.buildYearOrder();
+    HorseSet affected;
+    descendantsOf(ped, d.reparented, affected);
+    for (HorseId id : d.reparented) affected.insert(id);
+    d.affected.assign(affected.begin(), affected.end());      // ID 昇順
+    d.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
@@ -0,0 +1,153 @@
+﻿#pragma once
+//====================================================================
+//  propagate.h  ―― 「対象馬の血が全馬に何 % 含まれるか」(File-A) を
+//                   トポロジカル順の前進スイープ 1 回で求めるエンジン
+//
+//    血量(h) = (血量(父) + 血量(母)) / 2 ,  対象馬自身は 1.0
+//    親が必ず子より先に処理されるので再帰・メモ化・stk は不要。
+//    複数の対象馬は 1 頭あたり k 要素のベクトルとして同時に流す。
+//    列は COL_BLOCK 本ずつのブロックに分け、ブロック単位で並列に流せる。
+//    表全体がメモリに収まらないときは SpilledDescTable (列の帯ごとにファイルへ) を使う。
+//====================================================================
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "parallel.h"
+#include "pedigree.h"
+
+struct DescBloodTable {
+    size_t              width = 0;    // 対象馬の数 (列数)
+    std::vector<double> val;          // 行優先 [馬 ID][対象列]
+
+    double get(HorseId row, size_t col) const { return val[size_t(row) * width + col]; }
+};
+
+// 結果表のサイズ (MB)。呼び出し側でメモリ上限の判定に使う
+inline size_t descBloodTableMB(const Pedigree& ped, size_t targets) {
+    return ped.size() * targets * sizeof(double) / (1024 * 1024);
+}
+
+constexpr size_t COL_BLOCK = 64;   // 並列化の単位 (列数)
+
+//  列 [c0, c1) だけを前進スイープで埋める。out は確保済みであること
+inline void sweepDescBloodCols(const Pedigree& ped, const std::vector<HorseId>& targets,
+    size_t c0, size_t c1, DescBloodTable& out)
+{
+    const size_t k = out.width;
+    if (c0 >= c1) return;
+
+    // 対象馬を topo 位置順に並べ、最初の対象馬より前は全部 0 なので飛ばす
+    std::vector<std::pair<std::uint32_t, size_t>> seeds;   // (topoPos, 列)
+    seeds.reserve(c1 - c0);
+    for (size_t j = c0; j < c1; ++j) seeds.emplace_back(ped.topoPos[targets[j]], j);
+    std::sort(seeds.begin(), seeds.end());
+
+    double* v = out.val.data();
+    size_t nextSeed = 0;
+    for (size_t p = seeds[0].first; p < ped.topo.size(); ++p) {
+        const HorseId h = ped.topo[p];
+        double* row = v + size_t(h) * k;
+        const HorseId s = ped.sire[h], d = ped.dam[h];
+        if (s != NO_HORSE && d != NO_HORSE) {
+            const double* rs = v + size_t(s) * k;
+            const double* rd = v + size_t(d) * k;
+            for (size_t j = c0; j < c1; ++j) row[j] = 0.5 * rs[j] + 0.5 * rd[j];
+        }
+        else if (s != NO_HORSE || d != NO_HORSE) {
+            const double* rp = v + size_t(s != NO_HORSE ? s : d) * k;
+            for (size_t j = c0; j < c1; ++j) row[j] = 0.5 * rp[j];
+        }
+        // 対象馬自身は親に関係なく 1.0
+        for (; nextSeed < seeds.size() && seeds[nextSeed].first == p; ++nextSeed)
+            row[seeds[nextSeed].second] = 1.0;
+    }
+}
+
+//  targets[j] の血量を全馬について計算して out に格納する
+//  ※ ped.acyclic == true が前提 (loadBloodlineCSV で確認済み)
+inline void sweepDescBlood(const Pedigree& ped, const std::vector<HorseId>& targets,
+    DescBloodTable& out, unsigned threads = 1)
+{
+    const size_t k = targets.size();
+    out.width = k;
+    out.val.assign(ped.size() * k, 0.0);
+
+    const size_t blocks = (k + COL_BLOCK - 1) / COL_BLOCK;
+    WorkStealingPool(threads).run(blocks, [&](size_t b, unsigned) {
+        sweepDescBloodCols(ped, targets, b * COL_BLOCK, std::min(k, (b + 1) * COL_BLOCK), out);
+    });
+}
+
+//  表を列の帯 (幅 bandCols) ごとに作ってファイルへ書き出す版。常駐するのは 1 帯ぶん
+//  (N 行 × bandCols) だけ。ファイル内は帯ごとに N 行 × 幅の行優先で連続 (allpairs.h と同じ並び)
+class SpilledDescTable {
+public:
+    ~SpilledDescTable() { if (!path.empty()) std::remove(path.c_str()); }
+
+    bool build(const Pedigree& ped, const std::vector<HorseId>& targets, size_t bandCols,
+        const std::string& spillPath, unsigned threads = 1)
+    {
+        n = ped.size();  width = targets.size();
+        band = std::max<size_t>(1, std::min(bandCols, width));
+        path = spillPath;
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+        DescBloodTable t;
+        for (size_t c0 = 0; c0 < width; c0 += band) {
+            const std::vector<HorseId> cols(targets.begin() + c0, targets.begin() + std::min(width, c0 + band));
+            sweepDescBlood(ped, cols, t, threads);
+            f.write(reinterpret_cast<const char*>(t.val.data()), std::streamsize(t.val.size() * sizeof(double)));
+            if (!f) return false;
+        }
+        return bool(f.flush());
+    }
+
+    size_t bandWidth() const { return band; }
+
+    //  馬 row の全列を out[width] に読み出す。reader はスレッドごとに持つ
+    struct Reader { std::ifstream f; };
+    bool readRow(HorseId row, double* out, Reader& rd) const {
+        if (!rd.f.is_open()) rd.f.open(path, std::ios::binary);
+        for (size_t c0 = 0; c0 < width; c0 += band) {
+            const size_t k = std::min(width, c0 + band) - c0;
+            rd.f.seekg(std::streamoff((std::uint64_t(n) * c0 + std::uint64_t(row) * k) * sizeof(double)));
+            rd.f.read(reinterpret_cast<char*>(out + c0), std::streamsize(k * sizeof(double)));
+            if (!rd.f) return false;
+        }
+        return true;
+    }
+
+private:
+    size_t n = 0, width = 0, band = 1;
+    std::string path;
+};
+
+//  対象馬 1 頭ぶんの疎版: 子孫だけを topo 順に流す (問い合わせサーバ向け)
+//  out = {子孫 ID → 血量} (ID 昇順, 対象馬自身は含めない)。全馬を舐めないので O(子孫数)
+inline void descendantVector(const Pedigree& ped, HorseId target,
+    std::vector<std::pair<HorseId, double>>& out)
+{
+    out.clear();
+    std::vector<HorseId> desc;
+    std::unordered_map<HorseId, double> val{ { target, 1.0 } };
+    for (size_t i = 0, n = 1; i < n; ++i) {
+        const HorseId cur = i ? desc[i - 1] : target;
+        for (const HorseId* ch = ped.childrenBegin(cur); ch != ped.childrenEnd(cur); ++ch)
+            if (val.emplace(*ch, 0.0).second) { desc.push_back(*ch);  ++n; }
+    }
+    std::sort(desc.begin(), desc.end(),
+        [&](HorseId a, HorseId b) { return ped.topoPos[a] < ped.topoPos[b]; });
+    auto get = [&](HorseId p) { auto it = val.find(p);  return it == val.end() ? 0.0 : it->second; };
+    for (HorseId h : desc) {
+        double v = 0.0;
+        if (ped.sire[h] != NO_HORSE) v += 0.5 * get(ped.sire[h]);
+        if (ped.dam[h] != NO_HORSE)  v += 0.5 * get(ped.dam[h]);
+        val[h] = v;
+        out.emplace_back(h, v);
+    }
+    std::sort(out.begin(), out.end());
+}
@@ -0,0 +1,330 @@
+﻿#pragma once
+//====================================================================
+//  query_server.h  ―― ローカル Unix ドメインソケットの常駐問い合わせサーバ
+//
+//    プロトコル (1 行 1 要求, 改行で終端。タブを含む行はタブ区切り、それ以外は空白区切り):
+//      要求   : CMD arg1 arg2 ...
+//      応答   : "OK <値>" 1 行、または "OK <n>" の後に n 行。失敗は "ERR <理由>"
+//      組込み : PING / STATS (コマンド別の遅延分布) / QUIT (接続を閉じる) / SHUTDOWN
+//    それ以外のコマンドは route() で登録したハンドラに渡す。
+//    run() のスレッドが待ち受けと全接続の受信を poll() でまとめて見張り、改行まで届いた
+//    接続だけを固定数のワーカーへ渡す。ワーカーは届いている要求を全部処理して接続を返す
+//    (黙ったままの接続・keep-alive の接続がいくつあってもワーカーは塞がらない)。
+//    ハンドラは複数スレッドから同時に呼ばれる。1 接続の要求は届いた順に 1 つずつ処理する。
+//    1 行は MAX_LINE バイトまで。改行が来ないまま超えたら ERR を返して閉じる。
+//    Windows 10 1803 以降は AF_UNIX (afunix.h) をそのまま使う。
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "latency_histogram.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+class QueryServer {
+public:
+    // tok[0] = コマンド (大文字化済み)。true なら out に応答全体 ("OK …\n" 以降) を書く。
+    // false を返すと out を理由とした ERR 応答になる
+    using Handler = std::function<bool(const std::vector<std::string>& tok, std::string& out)>;
+
+    static constexpr size_t MAX_LINE = 64 * 1024;
+
+    QueryServer() = default;
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+    ~QueryServer() { closeListen(); }
+
+    void route(const std::string& cmd, Handler h) {
+        routes[cmd] = { std::move(h), std::make_unique<LatencyHistogram>() };
+    }
+
+    bool listen(const std::string& p) {
+        path = p;
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+#endif
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path) return false;
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);              // 前回の残骸
+        lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (lfd == BAD_SOCK) return false;
+        if (::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || ::listen(lfd, 64) != 0) {
+            closeListen();
+            return false;
+        }
+        // poll() を起こすための自分宛ての接続 (ワーカーが接続を返したとき・stop() のとき 1 バイト送る)
+        wakeTx = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (wakeTx == BAD_SOCK || ::connect(wakeTx, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0
+            || (wakeRx = ::accept(lfd, nullptr, nullptr)) == BAD_SOCK) {
+            closeListen();
+            return false;
+        }
+        return true;
+    }
+
+    //  SHUTDOWN を受けるか stop() されるまで接続を受け付ける。戻る時には全接続を閉じ終えている
+    //  nWorkers 本のワーカーは最初に warm() を呼ぶ (スレッドごとの作業領域を先に確保する)
+    void run(unsigned nWorkers, const std::function<void()>& warm = {}) {
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < std::max(1u, nWorkers); ++w)
+            workers.emplace_back([this, &warm] {
+                if (warm) warm();
+                std::unique_ptr<Conn> c;
+                while (nextReady(c)) {
+                    serve(*c);
+                    giveBack(std::move(c));
+                }
+            });
+
+        std::vector<std::unique_ptr<Conn>> idle;        // 受信待ちの接続 (このスレッドだけが触る)
+        std::vector<pollfd_t> fds;
+        char buf[16 * 1024];
+        while (!stopping.load()) {
+            const size_t nIdle = idle.size();
+            fds.clear();
+            fds.push_back({ lfd, READ_EV, 0 });
+            fds.push_back({ wakeRx, READ_EV, 0 });
+            for (const auto& c : idle) fds.push_back({ c->s, READ_EV, 0 });
+            if (pollSocks(fds, 200) <= 0) continue;
+
+            for (size_t i = 0; i < nIdle; ++i) {
+                if (!fds[i + 2].revents) continue;
+                Conn& c = *idle[i];
+                const long r = recvSome(c.s, buf, sizeof buf);
+                if (r <= 0) { c.closing = true;  continue; }
+                c.in.append(buf, size_t(r));
+                if (c.in.find('\n', c.in.size() - size_t(r)) != std::string::npos) {
+                    std::lock_guard<std::mutex> g(mu);
+                    ready.push_back(std::move(idle[i]));
+                    readyCv.notify_one();
+                }
+                else if (c.in.size() > MAX_LINE) {
+                    static const char tooLong[] = "ERR line too long\n";
+                    sendAll(c.s, tooLong, sizeof tooLong - 1);
+                    c.closing = true;
+                }
+            }
+            idle.erase(std::remove_if(idle.begin(), idle.end(), [&](std::unique_ptr<Conn>& c) {
+                if (c && c->closing) { closeSock(c->s);  c.reset(); }
+                return !c;
+            }), idle.end());
+
+            if (fds[0].revents) {
+                sock_t s = ::accept(lfd, nullptr, nullptr);
+                if (s != BAD_SOCK) idle.push_back(std::make_unique<Conn>(Conn{ s, {}, false }));
+            }
+            if (fds[1].revents) {
+                recvSome(wakeRx, buf, sizeof buf);
+                std::lock_guard<std::mutex> g(mu);
+                for (auto& c : returned) {
+                    if (c->closing) closeSock(c->s);
+                    else idle.push_back(std::move(c));
+                }
+                returned.clear();
+            }
+        }
+
+        readyCv.notify_all();
+        for (auto& t : workers) t.join();
+        for (auto& c : idle) closeSock(c->s);
+        for (auto& c : ready) closeSock(c->s);
+        for (auto& c : returned) closeSock(c->s);
+        ready.clear();  returned.clear();
+        closeListen();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> g(mu);
+            stopping = true;
+        }
+        readyCv.notify_all();
+        wake();
+    }
+
+    // コマンドごとの件数と遅延 (µs)
+    std::string statsText() const {
+        std::string s;
+        char line[160];
+        for (const auto& r : routes) {
+            const LatencyHistogram& h = *r.second.hist;
+            std::snprintf(line, sizeof line,
+                "%-8s n=%llu mean=%.1f p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f us\n",
+                r.first.c_str(), (unsigned long long)h.count(), h.meanNs() / 1e3,
+                h.percentile(0.50) / 1e3, h.percentile(0.90) / 1e3,
+                h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3, h.maxNs() / 1e3);
+            s += line;
+        }
+        return s;
+    }
+
+private:
+#ifdef _WIN32
+    using sock_t = SOCKET;
+    static constexpr sock_t BAD_SOCK = INVALID_SOCKET;
+    static void closeSock(sock_t s) { ::closesocket(s); }
+    using pollfd_t = WSAPOLLFD;
+    static constexpr short READ_EV = POLLRDNORM;
+    static int pollSocks(std::vector<pollfd_t>& f, int ms) { return WSAPoll(f.data(), ULONG(f.size()), ms); }
+    static bool sendAll(sock_t s, const char* p, size_t n) {
+        while (n) {
+            int w = ::send(s, p, int(std::min<size_t>(n, 1 << 30)), 0);
+            if (w <= 0) return false;
+            p += w;  n -= size_t(w);
+        }
+        return true;
+    }
+    static long recvSome(sock_t s, char* p, size_t n) { return ::recv(s, p, int(n), 0); }
+#else
+    using sock_t = int;
+    static constexpr sock_t BAD_SOCK = -1;
+    static void closeSock(sock_t s) { ::close(s); }
+    using pollfd_t = pollfd;
+    static constexpr short READ_EV = POLLIN;
+    static int pollSocks(std::vector<pollfd_t>& f, int ms) { return ::poll(f.data(), nfds_t(f.size()), ms); }
+    static bool sendAll(sock_t s, const char* p, size_t n) {
+        while (n) {
+            ssize_t w = ::send(s, p, n, MSG_NOSIGNAL);
+            if (w <= 0) return false;
+            p += w;  n -= size_t(w);
+        }
+        return true;
+    }
+    static long recvSome(sock_t s, char* p, size_t n) { return long(::recv(s, p, n, 0)); }
+#endif
+
+    struct Route {
+        Handler handler;
+        std::unique_ptr<LatencyHistogram> hist;
+    };
+
+    //  1 接続ぶんの状態。受信待ちの間は run() のスレッド、要求の処理中は 1 つのワーカーが持つ
+    struct Conn {
+        sock_t s;
+        std::string in;          // 受信済みでまだ処理していないバイト列
+        bool closing;            // QUIT / 送受信の失敗 → 閉じる
+    };
+
+    void closeListen() {
+        for (sock_t* w : { &wakeTx, &wakeRx })
+            if (*w != BAD_SOCK) { closeSock(*w);  *w = BAD_SOCK; }
+        if (lfd != BAD_SOCK) {
+            closeSock(lfd);  lfd = BAD_SOCK;
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    }
+
+    void wake() {
+        const char b = 1;
+        if (wakeTx != BAD_SOCK) sendAll(wakeTx, &b, 1);
+    }
+
+    //  要求が届いている接続を取る。false = 終了
+    bool nextReady(std::unique_ptr<Conn>& c) {
+        std::unique_lock<std::mutex> lk(mu);
+        readyCv.wait(lk, [&] { return stopping.load() || !ready.empty(); });
+        if (stopping.load()) return false;
+        c = std::move(ready.front());  ready.pop_front();
+        return true;
+    }
+
+    //  処理し終えた接続を run() の見張りに戻す
+    void giveBack(std::unique_ptr<Conn> c) {
+        {
+            std::lock_guard<std::mutex> g(mu);
+            returned.push_back(std::move(c));
+        }
+        wake();
+    }
+
+    // 届いている行を全部処理して応答を返す (行の途中は c.in に残す)
+    void serve(Conn& c) {
+        std::string out;
+        size_t pos = 0;
+        for (size_t nl; !c.closing && (nl = c.in.find('\n', pos)) != std::string::npos; pos = nl + 1) {
+            out.clear();
+            if (!dispatch(c.in.substr(pos, nl - pos), out)) c.closing = true;
+            if (!sendAll(c.s, out.data(), out.size())) c.closing = true;
+        }
+        c.in.erase(0, pos);
+    }
+
+    // 1 要求を処理して応答を out に積む。false = 接続を閉じる
+    bool dispatch(const std::string& line, std::string& out) {
+        // 空白を含む PrimaryKey はタブ区切りで送る
+        std::vector<std::string> tok;
+        const bool tabs = line.find('\t') != std::string::npos;
+        auto isSep = [&](char ch) {
+            return tabs ? (ch == '\t' || ch == '\r') : bool(std::isspace((unsigned char)ch));
+        };
+        for (size_t i = 0; i < line.size(); ) {
+            while (i < line.size() && isSep(line[i])) ++i;
+            size_t j = i;
+            while (j < line.size() && !isSep(line[j])) ++j;
+            if (j > i) tok.emplace_back(line, i, j - i);
+            i = j;
+        }
+        if (tok.empty()) return true;
+        for (char& ch : tok[0]) ch = char(std::toupper((unsigned char)ch));
+
+        const std::string& cmd = tok[0];
+        if (cmd == "PING") { out = "OK PONG\n";  return true; }
+        if (cmd == "QUIT") { out = "OK BYE\n";   return false; }
+        if (cmd == "SHUTDOWN") { out = "OK BYE\n";  stop();  return false; }
+        if (cmd == "STATS") {
+            std::string s = statsText();
+            out = "OK " + std::to_string(std::count(s.begin(), s.end(), '\n')) + '\n' + s;
+            return true;
+        }
+
+        auto it = routes.find(cmd);
+        if (it == routes.end()) { out = "ERR unknown command " + cmd + '\n';  return true; }
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::string body;
+        const bool ok = it->second.handler(tok, body);
+        it->second.hist->record(std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0).count()));
+        out = ok ? body : "ERR " + body + '\n';
+        return true;
+    }
+
+    std::string path;
+    sock_t lfd = BAD_SOCK;
+    std::map<std::string, Route> routes;     // run() 前に登録し、以後は読むだけ
+    std::atomic<bool> stopping{ false };
+    sock_t wakeTx = BAD_SOCK, wakeRx = BAD_SOCK;
+    std::mutex mu;
+    std::condition_variable readyCv;
+    std::deque<std::unique_ptr<Conn>> ready;       // 要求が届いていてワーカー待ち
+    std::vector<std::unique_ptr<Conn>> returned;   // ワーカーが処理し終えて見張りに戻す
+};
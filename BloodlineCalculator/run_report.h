@@ -0,0 +1,186 @@
+﻿#pragma once
+//====================================================================
+//  run_report.h  ―― 実行の計測 (工程ごとの時間・キャッシュ段ごとの件数・最大メモリ)
+//
+//    ・phase("名前")  : スコープを抜けるまでの時間を工程名ごとに積算 (呼ばれた順に並ぶ)
+//    ・recompute(d)   : getBlood が LRU / RocksDB で見つからず計算した 1 件 (d = 再帰の深さ)
+//    ・add / set      : 任意の名前付きカウンタ (呼び出しの少ない所で使う)
+//    ・メモリ         : 有効時は別スレッドで一定間隔に probe() を呼び、最大値を記録。
+//                       warnMB を超えたら 1 度だけ警告する (工程の境目でも確認)
+//    無効 (既定) のときは各呼び出しが分岐 1 つで戻る。write() で JSON に書き出す
+//====================================================================
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class RunReport {
+public:
+    using Clock = std::chrono::steady_clock;
+    using MemProbe = size_t(*)();
+
+    RunReport() = default;
+    RunReport(const RunReport&) = delete;
+    RunReport& operator=(const RunReport&) = delete;
+    ~RunReport() { stopSampler(); }
+
+    // メモリの監視は常に設定する (警告のため)。enable = true で計測と標本化も始める
+    void setup(MemProbe p, size_t warn, bool enable, unsigned sampleMs = 100) {
+        probe = p;  warnMB = warn;  on = enable;
+        t0 = Clock::now();
+        checkMemory();
+        if (on && probe) {
+            stopping = false;
+            sampler = std::thread([this, sampleMs] {
+                std::unique_lock<std::mutex> lk(sampleMu);
+                while (!sampleCv.wait_for(lk, std::chrono::milliseconds(sampleMs), [&] { return stopping; })) {
+                    lk.unlock();
+                    checkMemory();
+                    ++samples;
+                    lk.lock();
+                }
+            });
+        }
+    }
+    bool enabled() const { return on; }
+
+    //---------------- 工程 ----------------
+    class Phase {
+    public:
+        Phase(RunReport* r, const char* n) : rep(r), name(n), t(Clock::now()) {}
+        Phase(Phase&& o) noexcept : rep(o.rep), name(o.name), t(o.t) { o.rep = nullptr; }
+        Phase(const Phase&) = delete;
+        ~Phase() { stop(); }
+        void stop() { if (rep) { rep->endPhase(name, Clock::now() - t);  rep = nullptr; } }   // スコープより前に終える
+    private:
+        RunReport* rep;
+        const char* name;
+        Clock::time_point t;
+    };
+    Phase phase(const char* name) { return Phase(on || probe ? this : nullptr, name); }
+
+    //---------------- カウンタ ----------------
+    void recompute(size_t depth) {
+        if (!on) return;
+        recomputes.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t m = maxDepth.load(std::memory_order_relaxed);
+        while (depth > m && !maxDepth.compare_exchange_weak(m, depth, std::memory_order_relaxed)) {}
+    }
+    void add(const std::string& name, std::uint64_t v) { if (on) counter(name, v, true); }
+    void set(const std::string& name, std::uint64_t v) { if (on) counter(name, v, false); }
+    void note(const std::string& key, const std::string& value) {
+        if (!on) return;
+        std::lock_guard<std::mutex> g(mu);
+        notes.emplace_back(key, value);
+    }
+
+    //---------------- メモリ ----------------
+    void checkMemory() {
+        if (!probe) return;
+        const size_t mb = probe();
+        size_t p = peak.load(std::memory_order_relaxed);
+        while (mb > p && !peak.compare_exchange_weak(p, mb, std::memory_order_relaxed)) {}
+        if (mb > warnMB && !warned.exchange(true))
+            std::cerr << "[mem] 使用メモリが " << mb << " MB になりました (警告値 " << warnMB << " MB)\n";
+    }
+    size_t peakMB() const { return peak.load(); }
+
+    //  JSON を書き出す (無効時は何もしない)
+    bool write(const std::string& path) {
+        if (!on) return true;
+        stopSampler();
+        checkMemory();
+        std::ofstream f(path, std::ios::binary);
+        if (!f) return false;
+        char num[64];
+        auto ms = [&](Clock::duration d) {
+            std::snprintf(num, sizeof num, "%.3f", std::chrono::duration<double, std::milli>(d).count());
+            return std::string(num);
+        };
+        std::lock_guard<std::mutex> g(mu);
+        f << "{\n  \"wall_ms\": " << ms(Clock::now() - t0) << ",\n";
+        for (const auto& n : notes) f << "  \"" << escape(n.first) << "\": \"" << escape(n.second) << "\",\n";
+        f << "  \"phases\": [\n";
+        for (size_t i = 0; i < phases.size(); ++i)
+            f << "    {\"name\": \"" << escape(phases[i].name) << "\", \"ms\": " << ms(phases[i].total)
+              << ", \"calls\": " << phases[i].calls << '}' << (i + 1 < phases.size() ? "," : "") << '\n';
+        f << "  ],\n  \"counters\": {\n";
+        f << "    \"recomputes\": " << recomputes.load() << ",\n";
+        f << "    \"recursion_max_depth\": " << maxDepth.load();
+        for (const auto& c : counters) f << ",\n    \"" << escape(c.first) << "\": " << c.second;
+        f << "\n  },\n  \"memory\": {\"peak_mb\": " << peak.load() << ", \"threshold_mb\": " << warnMB
+          << ", \"exceeded\": " << (warned.load() ? "true" : "false") << ", \"samples\": " << samples.load()
+          << "}\n}\n";
+        return bool(f);
+    }
+
+private:
+    struct PhaseTotal {
+        std::string name;
+        Clock::duration total{};
+        std::uint64_t calls = 0;
+    };
+
+    void endPhase(const char* name, Clock::duration d) {
+        checkMemory();
+        if (!on) return;
+        std::lock_guard<std::mutex> g(mu);
+        auto it = std::find_if(phases.begin(), phases.end(), [&](const PhaseTotal& p) { return p.name == name; });
+        if (it == phases.end()) { phases.push_back({ name });  it = phases.end() - 1; }
+        it->total += d;  ++it->calls;
+    }
+
+    void counter(const std::string& name, std::uint64_t v, bool accumulate) {
+        std::lock_guard<std::mutex> g(mu);
+        for (auto& c : counters)
+            if (c.first == name) { c.second = accumulate ? c.second + v : v;  return; }
+        counters.emplace_back(name, v);
+    }
+
+    void stopSampler() {
+        if (!sampler.joinable()) return;
+        {
+            std::lock_guard<std::mutex> g(sampleMu);
+            stopping = true;
+        }
+        sampleCv.notify_all();
+        sampler.join();
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string o;
+        for (char c : s) {
+            if (c == '"' || c == '\\') { o += '\\';  o += c; }
+            else if ((unsigned char)c < 0x20) { char b[8];  std::snprintf(b, sizeof b, "\\u%04x", c);  o += b; }
+            else o += c;
+        }
+        return o;
+    }
+
+    bool on = false;
+    MemProbe probe = nullptr;
+    size_t warnMB = SIZE_MAX;
+    Clock::time_point t0 = Clock::now();
+
+    std::mutex mu;                                            // phases / counters / notes
+    std::vector<PhaseTotal> phases;
+    std::vector<std::pair<std::string, std::uint64_t>> counters;
+    std::vector<std::pair<std::string, std::string>> notes;
+    std::atomic<std::uint64_t> recomputes{ 0 }, maxDepth{ 0 }, samples{ 0 };
+    std::atomic<size_t> peak{ 0 };
+    std::atomic<bool> warned{ false };
+
+    std::thread sampler;
+    std::mutex sampleMu;
+    std::condition_variable sampleCv;
+    bool stopping = false;
+};
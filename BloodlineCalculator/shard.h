@@ -0,0 +1,135 @@
+﻿#pragma once
+//====================================================================
+//  shard.h  ―― 対象馬の多い問い合わせを複数プロセスで分担する (--shards N / --shard I/N)
+//
+//    ・分担     : 行列の列 (= 対象馬, PrimaryKey 順) を N 個の連続区間に分ける。
+//                 File-A / File-B とも列が対象馬なので、各ワーカーは自分の列ぶんの
+//                 スイープ・祖先ベクトルだけを計算する (行 = 全馬は全員同じ)
+//    ・部分ファイル : 全行 × 担当列の値を double の行優先でそのまま書く
+//                 (書式化の直前の値。絞り込み・0 の切り捨ては済んでいる)
+//                 統合側は行ごとに N 個を横につなぎ、単一プロセスと同じ書式化を通す
+//    ・チェックポイント : <部分>.ckpt に「署名 行数 列数 済み行数」。部分ファイルを
+//                 flush してから一時ファイル経由で置き換えるので、プロセスが落ちても
+//                 済み行数までは必ず部分ファイルにある。再開時はそこで切り詰めて続きを書く
+//====================================================================
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ShardSpec {
+    unsigned index = 0, count = 0;          // count が 0 / 1 なら分担しない
+
+    bool active() const { return count > 1; }
+
+    //  n 列のうち担当する [first, second)
+    std::pair<size_t, size_t> range(size_t n) const {
+        if (!active()) return { 0, n };
+        return { n * index / count, n * (index + 1) / count };
+    }
+};
+
+//  "I/N" (0 ≤ I < N)
+inline bool parseShardSpec(const std::string& s, ShardSpec& sp) {
+    const size_t slash = s.find('/');
+    if (slash == std::string::npos) return false;
+    try {
+        const unsigned long i = std::stoul(s.substr(0, slash)), n = std::stoul(s.substr(slash + 1));
+        if (n < 1 || i >= n) return false;
+        sp.index = unsigned(i);  sp.count = unsigned(n);
+    }
+    catch (...) { return false; }
+    return true;
+}
+
+//  部分ファイル名 (出力ファイル名 + ".part<I>of<N>")
+inline std::string shardPartPath(const std::string& file, const ShardSpec& sp) {
+    return file + ".part" + std::to_string(sp.index) + "of" + std::to_string(sp.count);
+}
+
+class MatrixPart {
+public:
+    //  rows 行 × cols 列、署名 sig の部分ファイルを開く。同じ署名のチェックポイントがあれば
+    //  その続きから書く。戻り値 = 書き済みの行数 (rows なら全部済み)
+    size_t open(const std::string& p, size_t rows, size_t cols, std::uint64_t sig) {
+        path = p;  nRows = rows;  nCols = cols;  signature = sig;
+        size_t done = readCheckpoint();
+        std::error_code ec;
+        if (done && std::filesystem::file_size(path, ec) >= done * rowBytes() && !ec)
+            std::filesystem::resize_file(path, done * rowBytes(), ec);
+        else done = 0;
+        if (ec) done = 0;
+        if (done == nRows) return done;
+        f.open(path, std::ios::binary | (done ? std::ios::app : std::ios::trunc));
+        if (!f) return SIZE_MAX;
+        if (!done) checkpoint(0);
+        return done;
+    }
+
+    bool append(const std::string& bytes) {
+        f.write(bytes.data(), std::streamsize(bytes.size()));
+        return bool(f);
+    }
+
+    //  ここまでの rowsDone 行を確定させる
+    bool checkpoint(size_t rowsDone) {
+        if (f.is_open() && !f.flush()) return false;
+        const std::string tmp = ckptPath() + ".tmp";
+        {
+            std::ofstream c(tmp, std::ios::trunc);
+            c << signature << ' ' << nRows << ' ' << nCols << ' ' << rowsDone << '\n';
+            if (!c.flush()) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, ckptPath(), ec);
+        return !ec;
+    }
+
+    bool finish() {
+        const bool ok = checkpoint(nRows);
+        if (f.is_open()) f.close();
+        return ok;
+    }
+
+    std::string ckptPath() const { return path + ".ckpt"; }
+    size_t rowBytes() const { return nCols * sizeof(double); }
+
+    //---------------- 統合側の読み出し ----------------
+    //  checkpoint が全行済みで、ファイルの大きさも合っているか
+    static bool complete(const std::string& p, size_t rows, size_t cols, std::uint64_t sig) {
+        MatrixPart m;
+        m.path = p;  m.nRows = rows;  m.nCols = cols;  m.signature = sig;
+        std::error_code ec;
+        return m.readCheckpoint() == rows && std::filesystem::file_size(p, ec) == rows * m.rowBytes() && !ec;
+    }
+
+    //  部分ファイルの ri 行目 (cols 個) を out へ
+    static bool readRow(std::ifstream& in, size_t ri, size_t cols, double* out) {
+        in.seekg(std::streamoff(std::uint64_t(ri) * cols * sizeof(double)));
+        in.read(reinterpret_cast<char*>(out), std::streamsize(cols * sizeof(double)));
+        return bool(in);
+    }
+
+    static void remove(const std::string& p) {
+        std::error_code ec;
+        std::filesystem::remove(p, ec);
+        std::filesystem::remove(p + ".ckpt", ec);
+    }
+
+private:
+    //  署名と形が一致するチェックポイントの済み行数 (無ければ 0)
+    size_t readCheckpoint() const {
+        std::ifstream c(ckptPath());
+        std::uint64_t sig = 0;
+        size_t rows = 0, cols = 0, done = 0;
+        if (!(c >> sig >> rows >> cols >> done)) return 0;
+        return sig == signature && rows == nRows && cols == nCols && done <= nRows ? done : 0;
+    }
+
+    std::string   path;
+    size_t        nRows = 0, nCols = 0;
+    std::uint64_t signature = 0;
+    std::ofstream f;
+};
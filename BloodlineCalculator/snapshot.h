@@ -0,0 +1,206 @@
+﻿#pragma once
+//====================================================================
+//  snapshot.h  ―― 読込済み血統表のバイナリスナップショット
+//
+//    --compile で bloodline.csv を解析した結果を 1 ファイルに書き出し、
+//    通常実行ではそれを mmap し、各セクションを vector へ一括コピーして
+//    CSV の解析・ソートを丸ごと省く (ped は vector を持つので、その場では使わない)。
+//
+//    [SnapHeader] [sire] [dam] [year] [childBegin] [childList] [topo]
+//    [yearOrder] [文字列表 × 4 : key / name / yearStr / sex]
+//      ・各セクションは 8B 境界に揃え、位置は header.off[] に記録
+//      ・文字列表 = オフセット u64 × (n+1) + 連結した文字列
+//      ・header.csvHash が元 CSV の内容と違えば使わない
+//      ・書き出しは path.tmp に書いて flush してから置き換える (途中で落ちても
+//        前のファイルか何も無い状態のまま)。読込時は全セクションの終端と
+//        文字列表のオフセットをファイルの大きさと突き合わせ、馬 ID・childBegin も
+//        範囲を確かめる。どれかが外れていれば使わない (CSV から読む)
+//====================================================================
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "mapped_file.h"
+#include "pedigree.h"
+
+namespace snapshot {
+
+constexpr char          MAGIC[8] = { 'B','L','D','S','N','A','P','\0' };
+constexpr std::uint32_t VERSION = 2;      // 2: sex を追加
+
+enum Section { SIRE, DAM, YEAR, CHILD_BEGIN, CHILD_LIST, TOPO, YEAR_ORDER, KEY, NAME, YEAR_STR, SEX, NSEC };
+
+struct SnapHeader {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t n;            // 頭数
+    std::uint64_t csvHash;
+    std::uint64_t nChild;       // childList の要素数
+    std::uint64_t nTopo;        // topo の要素数 (循環があれば n 未満)
+    std::uint64_t off[NSEC];
+};
+
+// CSV の中身の 64bit ハッシュ (8B ずつ混ぜる。mmap 済みの領域を 1 回なめるだけ)
+inline std::uint64_t hashBytes(const char* p, size_t n) {
+    std::uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        std::uint64_t w;  std::memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i) { h = (h ^ std::uint8_t(p[i])) * 0x100000001b3ULL; }
+    h ^= h >> 33;  h *= 0xc4ceb9fe1a85ec53ULL;  h ^= h >> 33;
+    return h;
+}
+
+inline bool hashFile(const std::string& path, std::uint64_t& h) {
+    MappedFile mf;
+    if (!mf.open(path)) return false;
+    h = hashBytes(mf.data(), mf.size());
+    return true;
+}
+
+} // namespace snapshot
+
+//  ped を path に書き出す (yearOrder / topo は作成済みであること)
+inline bool writeSnapshot(const std::string& path, const Pedigree& ped, std::uint64_t csvHash) {
+    using namespace snapshot;
+    const std::string tmp = path + ".tmp";
+    std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+    if (!ofs) return false;
+
+    SnapHeader h{};
+    h.version = VERSION;
+    h.n = (std::uint32_t)ped.size();
+    h.csvHash = csvHash;
+    h.nChild = ped.childList.size();
+    h.nTopo = ped.topo.size();
+    ofs.write(reinterpret_cast<const char*>(&h), sizeof h);   // magic と off[] は最後に書き直す
+
+    auto align = [&] {
+        static const char zero[8] = {};
+        auto pos = (std::uint64_t)ofs.tellp();
+        if (pos % 8) ofs.write(zero, std::streamsize(8 - pos % 8));
+    };
+    auto section = [&](Section s, const void* p, size_t bytes) {
+        align();
+        h.off[s] = (std::uint64_t)ofs.tellp();
+        ofs.write(static_cast<const char*>(p), std::streamsize(bytes));
+    };
+    auto strings = [&](Section s, const std::vector<std::string>& v) {
+        std::vector<std::uint64_t> off(v.size() + 1, 0);
+        for (size_t i = 0; i < v.size(); ++i) off[i + 1] = off[i] + v[i].size();
+        section(s, off.data(), off.size() * sizeof(std::uint64_t));
+        for (const auto& str : v) ofs.write(str.data(), std::streamsize(str.size()));
+    };
+
+    const size_t n = ped.size();
+    section(SIRE, ped.sire.data(), n * sizeof(HorseId));
+    section(DAM, ped.dam.data(), n * sizeof(HorseId));
+    section(YEAR, ped.year.data(), n * sizeof(int));
+    section(CHILD_BEGIN, ped.childBegin.data(), (n + 1) * sizeof(std::uint32_t));
+    section(CHILD_LIST, ped.childList.data(), ped.childList.size() * sizeof(HorseId));
+    section(TOPO, ped.topo.data(), ped.topo.size() * sizeof(HorseId));
+    section(YEAR_ORDER, ped.yearOrder.data(), n * sizeof(HorseId));
+    strings(KEY, ped.key);
+    strings(NAME, ped.name);
+    strings(YEAR_STR, ped.yearStr);
+    strings(SEX, ped.sex);
+
+    std::memcpy(h.magic, MAGIC, 8);
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char*>(&h), sizeof h);
+    ofs.close();
+    std::error_code ec;
+    if (ofs) std::filesystem::rename(tmp, path, ec);
+    if (!ofs || ec) { std::filesystem::remove(tmp, ec);  return false; }
+    return true;
+}
+
+//  path を mmap して ped を復元する。版・ハッシュが合わない、または壊れていれば false
+inline bool loadSnapshot(const std::string& path, Pedigree& ped, std::uint64_t csvHash) {
+    using namespace snapshot;
+    MappedFile mf;
+    if (!mf.open(path) || mf.size() < sizeof(SnapHeader)) return false;
+    const char* base = mf.data();
+    SnapHeader h;
+    std::memcpy(&h, base, sizeof h);
+    if (std::memcmp(h.magic, MAGIC, 8) != 0 || h.version != VERSION || h.csvHash != csvHash)
+        return false;
+
+    // 各セクションがファイルに収まっているか (途中で切れたファイルを弾く)
+    const std::uint64_t size = mf.size(), n = h.n;
+    auto fits = [&](Section s, std::uint64_t count, std::uint64_t elem) {
+        return h.off[s] <= size && count <= (size - h.off[s]) / elem;
+    };
+    if (!fits(SIRE, n, sizeof(HorseId)) || !fits(DAM, n, sizeof(HorseId)) || !fits(YEAR, n, sizeof(int))
+        || !fits(CHILD_BEGIN, n + 1, sizeof(std::uint32_t)) || !fits(CHILD_LIST, h.nChild, sizeof(HorseId))
+        || !fits(TOPO, h.nTopo, sizeof(HorseId)) || !fits(YEAR_ORDER, n, sizeof(HorseId)))
+        return false;
+    for (Section s : { KEY, NAME, YEAR_STR, SEX }) {
+        if (!fits(s, n + 1, sizeof(std::uint64_t))) return false;
+        const std::uint64_t chars = h.off[s] + (n + 1) * sizeof(std::uint64_t);
+        std::uint64_t prev = 0;
+        for (size_t i = 0; i <= n; ++i) {
+            std::uint64_t o;
+            std::memcpy(&o, base + h.off[s] + i * sizeof o, sizeof o);
+            if (o < prev || o > size - chars) return false;
+            prev = o;
+        }
+    }
+
+    auto arr = [&](Section s, auto& v, size_t count) {
+        using T = typename std::decay_t<decltype(v)>::value_type;
+        v.resize(count);
+        if (count) std::memcpy(v.data(), base + h.off[s], count * sizeof(T));
+    };
+    auto strings = [&](Section s, std::vector<std::string>& v) {
+        const auto* off = reinterpret_cast<const std::uint64_t*>(base + h.off[s]);
+        const char* chars = base + h.off[s] + (size_t(h.n) + 1) * sizeof(std::uint64_t);
+        v.resize(h.n);
+        for (size_t i = 0; i < h.n; ++i) v[i].assign(chars + off[i], size_t(off[i + 1] - off[i]));
+    };
+
+    arr(SIRE, ped.sire, n);
+    arr(DAM, ped.dam, n);
+    arr(YEAR, ped.year, n);
+    arr(CHILD_BEGIN, ped.childBegin, n + 1);
+    arr(CHILD_LIST, ped.childList, size_t(h.nChild));
+    arr(TOPO, ped.topo, size_t(h.nTopo));
+    arr(YEAR_ORDER, ped.yearOrder, n);
+
+    // 中身 (csvHash は CSV の指紋で本体は守らないので、ビット化けしたファイルでも範囲外に書かないように)
+    //   ・親は < n か NO_HORSE、子・topo・年順は < n
+    //   ・childBegin は 0 から単調増加で nChild で終わる、topo は n 頭以下
+    auto ids = [&](const std::vector<HorseId>& v, bool allowNone) {
+        return std::all_of(v.begin(), v.end(), [&](HorseId id) { return id < n || (allowNone && id == NO_HORSE); });
+    };
+    bool good = h.nTopo <= n && ids(ped.sire, true) && ids(ped.dam, true)
+        && ids(ped.childList, false) && ids(ped.topo, false) && ids(ped.yearOrder, false)
+        && ped.childBegin[0] == 0 && ped.childBegin[n] == h.nChild;
+    for (size_t i = 0; good && i < n; ++i) good = ped.childBegin[i] <= ped.childBegin[i + 1];
+    if (!good) { ped = Pedigree();  return false; }       // CSV から読み直す
+
+    strings(KEY, ped.key);
+    strings(NAME, ped.name);
+    strings(YEAR_STR, ped.yearStr);
+    strings(SEX, ped.sex);
+
+    // 派生データ (表示名・逆引き・topo 位置) を組み直す
+    ped.display.resize(n);
+    ped.idOf.clear();  ped.idOf.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        ped.display[i].reserve(ped.name[i].size() + ped.yearStr[i].size() + 3);
+        ped.display[i].assign(ped.name[i]).append(" [").append(ped.yearStr[i]).append("]");
+        ped.idOf.emplace(ped.key[i], (HorseId)i);
+    }
+    ped.topoPos.assign(n, std::uint32_t(-1));
+    for (size_t p = 0; p < ped.topo.size(); ++p) ped.topoPos[ped.topo[p]] = (std::uint32_t)p;
+    ped.acyclic = (ped.topo.size() == n);
+    return true;
+}
@@ -0,0 +1,163 @@
+﻿#pragma once
+//====================================================================
+//  synth_pedigree.h  ―― ベンチマーク用の合成血統表 (bloodline.csv と同じ列構成)
+//
+//    ・世代 0 は父母不明の基礎馬。以降の世代は直前 SIRE_WINDOW 世代から親を選ぶ
+//    ・種牡馬は牡の一部 (sireFraction) だけ。人気は Zipf (sireSkew) で偏らせる
+//      → 人気種牡馬を通じた近親ループが自然にできる
+//    ・inbreedRate の割合で「父の父の娘」を母にする (3×3 の近親配合)
+//    ・cycles > 0 なら祖先の父を子孫に書き換えて循環 (データ誤り) を作る
+//    ・乱数は splitmix64 の自前実装 (std の分布は実装ごとに値が違うので使わない)。
+//      同じ設定・seed なら同じ CSV になる
+//====================================================================
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "output_writer.h"
+
+struct SynthConfig {
+    size_t        horses = 200'000;     // 総頭数 (〜1000 万)
+    unsigned      generations = 20;     // 世代数 (1〜40)
+    std::uint64_t seed = 1;
+    double        sireFraction = 0.03;  // 牡のうち種牡馬になる割合
+    double        sireSkew = 1.1;       // 種牡馬人気の Zipf 指数 (大きいほど寡占)
+    double        inbreedRate = 0.05;   // 父の父の娘を母にする割合
+    size_t        cycles = 0;           // 循環を作る数
+    int           firstYear = 1700;
+};
+
+struct SynthStats {
+    size_t horses = 0, founders = 0, stallions = 0, inbred = 0, cycles = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+namespace synth {
+
+constexpr std::uint32_t NONE = 0xFFFFFFFFu;
+constexpr unsigned SIRE_WINDOW = 3;     // 親を選ぶ世代の幅
+constexpr unsigned YEARS_PER_GEN = 8;
+
+struct Rng {
+    std::uint64_t s;
+    std::uint64_t next() {
+        std::uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    double unit() { return double(next() >> 11) * (1.0 / 9007199254740992.0); }   // [0,1)
+    std::uint32_t below(size_t n) { return std::uint32_t(unit() * double(n)); }
+    bool chance(double p) { return unit() < p; }
+};
+
+} // namespace synth
+
+//  合成血統表を path に書き出す (ヘッダ + 1 行 1 頭, ID 順 = 世代順)
+inline bool writeSynthPedigree(const std::string& path, const SynthConfig& cfgIn, SynthStats* st = nullptr)
+{
+    using namespace synth;
+    auto t0 = std::chrono::steady_clock::now();
+    SynthConfig c = cfgIn;
+    c.generations = std::max(1u, std::min(40u, c.generations));
+    c.horses = std::max<size_t>(c.horses, 2 * size_t(c.generations));
+    Rng rng{ c.seed };
+    SynthStats s;
+
+    const size_t n = c.horses;
+    std::vector<std::uint32_t> sire(n, NONE), dam(n, NONE), genBegin(c.generations + 1);
+    std::vector<std::uint8_t>  male(n), gen(n);
+    std::vector<std::int16_t>  yearOff(n);
+    for (unsigned g = 0; g <= c.generations; ++g) genBegin[g] = std::uint32_t(n * g / c.generations);
+
+    std::vector<std::vector<std::uint32_t>> stallionsOf(c.generations), maresOf(c.generations);
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> daughters;   // 種牡馬 → 娘
+
+    for (unsigned g = 0; g < c.generations; ++g) {
+        // --- 親の候補 (直前 SIRE_WINDOW 世代) ---
+        std::vector<std::uint32_t> sirePool, marePool;
+        for (unsigned w = 1; w <= SIRE_WINDOW && w <= g; ++w) {
+            sirePool.insert(sirePool.end(), stallionsOf[g - w].begin(), stallionsOf[g - w].end());
+            marePool.insert(marePool.end(), maresOf[g - w].begin(), maresOf[g - w].end());
+        }
+        // 人気順 = 候補内の並び (世代ごとにシャッフル済み)。重み 1/(r+1)^skew の累積
+        std::vector<double> cum(sirePool.size());
+        double acc = 0;
+        for (size_t r = 0; r < sirePool.size(); ++r) { acc += 1.0 / std::pow(double(r + 1), c.sireSkew);  cum[r] = acc; }
+
+        for (std::uint32_t h = genBegin[g]; h < genBegin[g + 1]; ++h) {
+            gen[h] = std::uint8_t(g);
+            male[h] = std::uint8_t(rng.next() & 1);
+            yearOff[h] = std::int16_t(g * YEARS_PER_GEN + rng.below(YEARS_PER_GEN));
+            if (sirePool.empty() || marePool.empty()) { ++s.founders;  continue; }
+
+            const size_t r = std::lower_bound(cum.begin(), cum.end(), rng.unit() * acc) - cum.begin();
+            const std::uint32_t sr = sirePool[std::min(r, sirePool.size() - 1)];
+            std::uint32_t dm = NONE;
+            if (sire[sr] != NONE && rng.chance(c.inbreedRate)) {
+                auto it = daughters.find(sire[sr]);            // 父の半姉妹
+                if (it != daughters.end() && !it->second.empty()) {
+                    const std::uint32_t cand = it->second[rng.below(it->second.size())];
+                    if (gen[cand] + SIRE_WINDOW >= g && gen[cand] < g) { dm = cand;  ++s.inbred; }
+                }
+            }
+            if (dm == NONE) dm = marePool[rng.below(marePool.size())];
+            sire[h] = sr;  dam[h] = dm;
+        }
+
+        // この世代の牡から種牡馬を選ぶ (最低 1 頭)。並びをシャッフルして人気順とする
+        for (std::uint32_t h = genBegin[g]; h < genBegin[g + 1]; ++h) {
+            if (male[h] && rng.chance(c.sireFraction)) stallionsOf[g].push_back(h);
+            else if (!male[h]) {
+                maresOf[g].push_back(h);
+                if (sire[h] != NONE) daughters[sire[h]].push_back(h);
+            }
+        }
+        if (stallionsOf[g].empty())
+            for (std::uint32_t h = genBegin[g]; h < genBegin[g + 1]; ++h)
+                if (male[h]) { stallionsOf[g].push_back(h);  break; }
+        auto& st_ = stallionsOf[g];
+        for (size_t i = st_.size(); i > 1; --i) std::swap(st_[i - 1], st_[rng.below(i)]);
+        s.stallions += st_.size();
+    }
+
+    // --- 循環: 孫世代以降の馬 h の父の父 a の父を h にする ---
+    for (size_t k = 0; k < c.cycles && c.generations >= 3; ++k) {
+        const std::uint32_t h = genBegin[2] + rng.below(n - genBegin[2]);
+        if (sire[h] == NONE || sire[sire[h]] == NONE) continue;
+        sire[sire[sire[h]]] = h;
+        ++s.cycles;
+    }
+
+    // --- 書き出し (bloodline.csv と同じ 11 列 + 末尾 1) ---
+    CsvOut out(path);
+    if (!out.ok()) return false;
+    const char* header = "PrimaryKey,Sire,Dam,Sex,Color,Year,Details,URL,Horse Name,Generation,LoadURL,\n";
+    out.put(header);
+    s.bytes = std::strlen(header);
+    std::string row, pk;
+    auto key = [](std::string& s, std::uint32_t id) { s.assign("S").append(std::to_string(id)); };
+    for (std::uint32_t h = 0; h < n; ++h) {
+        key(pk, h);
+        row.assign(pk).push_back(',');
+        if (sire[h] != NONE) { row.append("S").append(std::to_string(sire[h])); }
+        row.push_back(',');
+        if (dam[h] != NONE) { row.append("S").append(std::to_string(dam[h])); }
+        row.append(male[h] ? ",M,," : ",H,,").append(std::to_string(c.firstYear + yearOff[h]));
+        row.append(",").append(pk).append(",").append(pk).append(",Horse ").append(std::to_string(h));
+        row.append(",").append(std::to_string(gen[h])).append(",TRUE,1\n");
+        s.bytes += row.size();
+        out.put(row);
+    }
+    if (!out.close()) return false;
+
+    s.horses = n;
+    s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (st) *st = s;
+    return true;
+}
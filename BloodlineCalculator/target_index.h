@@ -0,0 +1,232 @@
+﻿#pragma once
+//====================================================================
+//  target_index.h  ―― 対象馬の選択 (読込時に作る索引 + 小さな問い合わせ構文)
+//
+//    索引 (build 後は読むだけなので、常駐サーバの複数スレッドから使える)
+//      ・年     : ped.yearOrder と同じ並びの年の配列。範囲は二分探索で 1 区間
+//      ・Sex    : Sex 列の値 (英字は小文字化) → ID 昇順の一覧
+//      ・父 / 母 : 親 → 子の CSR (ped.childBegin) をそのまま使う
+//      ・名前   : 名前順の ID。完全一致・前方一致は二分探索
+//    構文 (演算子は大小無視。並べただけの条件は AND)
+//      式   := 項 { OR 項 }     項 := 因子 { [AND] 因子 }     因子 := NOT 因子 | ( 式 ) | 条件
+//      条件 := year:1990 | year:1990-1995 | year:1990- | year:-1995 | sex:F
+//              | sire:X | dam:X | name:前方一致 | pk:PrimaryKey
+//              | 1990 | 1990-1995 | PrimaryKey            (従来の書き方)
+//      X は PrimaryKey、無ければ馬名の完全一致 (同名は全部)。空白を含む値は "..." で囲む
+//      例: year:1990-1995 AND sire:"Sunday Silence" AND NOT sex:M
+//====================================================================
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "closure.h"
+#include "pedigree.h"
+
+class TargetIndex {
+public:
+    void build(const Pedigree& p) {
+        ped = &p;
+        years.resize(p.yearOrder.size());
+        for (size_t i = 0; i < years.size(); ++i) years[i] = p.year[p.yearOrder[i]];
+
+        sexIds.clear();
+        for (HorseId id = 0; id < p.size(); ++id)
+            if (!p.sex[id].empty()) sexIds[lower(p.sex[id])].push_back(id);
+
+        nameOrder.clear();
+        for (HorseId id = 0; id < p.size(); ++id) if (!p.name[id].empty()) nameOrder.push_back(id);
+        std::sort(nameOrder.begin(), nameOrder.end(), [&](HorseId a, HorseId b) {
+            return p.name[a] == p.name[b] ? a < b : p.name[a] < p.name[b];
+        });
+    }
+    bool built() const { return ped && years.size() == ped->size(); }
+
+    //  式 q の結果を out に入れる (全馬ぶんの集合)。構文の誤りは err に書いて false
+    bool select(const std::string& q, HorseSet& out, std::string& err) const {
+        Parser ps{ *this, tokenize(q), 0, {} };
+        out = ps.expr();
+        if (ps.err.empty() && ps.pos < ps.toks.size()) ps.err = "余分な語: " + ps.toks[ps.pos].text;
+        err = ps.err;
+        return err.empty();
+    }
+
+    //  従来の年の書き方 ("1990" / "1990-1995")。PrimaryKey より優先する
+    static bool isYearToken(const std::string& t) {
+        int lo, hi;
+        return (t.size() == 4 || (t.size() == 9 && t[4] == '-')) && parseYears(t, lo, hi);
+    }
+
+    //---------------- 個々の索引 (out に足す) ----------------
+    void byYear(int lo, int hi, HorseSet& out) const {
+        auto b = std::lower_bound(years.begin(), years.end(), lo);
+        auto e = std::upper_bound(b, years.end(), hi);
+        for (auto it = b; it != e; ++it) out.insert(ped->yearOrder[size_t(it - years.begin())]);
+    }
+    void bySex(const std::string& s, HorseSet& out) const {
+        auto it = sexIds.find(lower(s));
+        if (it != sexIds.end()) for (HorseId id : it->second) out.insert(id);
+    }
+    //  parent の子のうち、父 (isSire) / 母として parent を持つ馬
+    void byParent(HorseId parent, bool isSire, HorseSet& out) const {
+        for (const HorseId* c = ped->childrenBegin(parent); c != ped->childrenEnd(parent); ++c)
+            if ((isSire ? ped->sire[*c] : ped->dam[*c]) == parent) out.insert(*c);
+    }
+    void byNamePrefix(std::string_view prefix, HorseSet& out) const {
+        auto b = std::lower_bound(nameOrder.begin(), nameOrder.end(), prefix,
+            [&](HorseId id, std::string_view v) { return std::string_view(ped->name[id]) < v; });
+        for (; b != nameOrder.end() && std::string_view(ped->name[*b]).substr(0, prefix.size()) == prefix; ++b)
+            out.insert(*b);
+    }
+    //  PrimaryKey、無ければ馬名の完全一致
+    void byHorse(const std::string& x, std::vector<HorseId>& ids) const {
+        ids.clear();
+        const HorseId id = ped->find(x);
+        if (id != NO_HORSE) { ids.push_back(id);  return; }
+        auto r = std::equal_range(nameOrder.begin(), nameOrder.end(), x, NameLess{ ped });
+        ids.assign(r.first, r.second);
+    }
+
+private:
+    struct NameLess {
+        const Pedigree* p;
+        bool operator()(HorseId a, const std::string& v) const { return p->name[a] < v; }
+        bool operator()(const std::string& v, HorseId a) const { return v < p->name[a]; }
+    };
+
+    struct Token {
+        std::string text;
+        bool   quoted = false;                   // "..." を含む (演算子・括弧とはみなさない)
+        size_t colon = std::string::npos;        // 引用符の外の最初の ':' (項目名の区切り)
+    };
+
+    static std::string lower(std::string s) {
+        for (char& c : s) c = char(std::tolower((unsigned char)c));
+        return s;
+    }
+
+    //  空白と括弧で区切る。"..." の中はそのまま (引用符は外す)
+    static std::vector<Token> tokenize(const std::string& q) {
+        std::vector<Token> t;
+        for (size_t i = 0; i < q.size(); ) {
+            const char c = q[i];
+            if (std::isspace((unsigned char)c)) { ++i;  continue; }
+            if (c == '(' || c == ')') { t.push_back({ std::string(1, c) });  ++i;  continue; }
+            Token w;
+            while (i < q.size() && !std::isspace((unsigned char)q[i]) && q[i] != '(' && q[i] != ')') {
+                if (q[i] == '"') {
+                    const size_t e = q.find('"', i + 1);
+                    w.text.append(q, i + 1, (e == std::string::npos ? q.size() : e) - i - 1);
+                    w.quoted = true;
+                    i = e == std::string::npos ? q.size() : e + 1;
+                }
+                else {
+                    if (q[i] == ':' && w.colon == std::string::npos) w.colon = w.text.size();
+                    w.text.push_back(q[i++]);
+                }
+            }
+            t.push_back(std::move(w));
+        }
+        return t;
+    }
+
+    //  "1990" / "1990-1995" / "1990-" / "-1995" → [lo, hi]
+    static bool parseYears(const std::string& s, int& lo, int& hi) {
+        auto num = [](const std::string& v, int& y) {
+            if (v.empty() || v.size() > 4 || !std::all_of(v.begin(), v.end(), ::isdigit)) return false;
+            y = std::stoi(v);
+            return true;
+        };
+        const size_t dash = s.find('-');
+        if (dash == std::string::npos) return num(s, lo) && (hi = lo, true);
+        const std::string a = s.substr(0, dash), b = s.substr(dash + 1);
+        lo = INT_MIN + 1;  hi = INT_MAX;           // 年不明 (INT_MIN) は開いた範囲にも入れない
+        if (a.empty() && b.empty()) return false;
+        if (!a.empty() && !num(a, lo)) return false;
+        if (!b.empty() && !num(b, hi)) return false;
+        if (lo > hi) std::swap(lo, hi);
+        return true;
+    }
+
+    struct Parser {
+        const TargetIndex& ix;
+        std::vector<Token> toks;
+        size_t pos;
+        std::string err;
+
+        bool isOp(const char* op) const {
+            return pos < toks.size() && !toks[pos].quoted && lower(toks[pos].text) == op;
+        }
+        HorseSet empty() const { return HorseSet(ix.ped->size()); }
+
+        HorseSet expr() {
+            HorseSet s = term();
+            while (err.empty() && isOp("or")) { ++pos;  s |= term(); }
+            return s;
+        }
+        HorseSet term() {
+            HorseSet s = factor();
+            while (err.empty() && pos < toks.size() && toks[pos].text != ")" && !isOp("or")) {
+                if (isOp("and")) ++pos;
+                s &= factor();
+            }
+            return s;
+        }
+        HorseSet factor() {
+            if (pos >= toks.size()) { err = "条件がありません";  return empty(); }
+            if (isOp("not")) {
+                ++pos;
+                HorseSet s = empty();
+                s.fill();
+                s -= factor();
+                return s;
+            }
+            if (!toks[pos].quoted && toks[pos].text == "(") {
+                ++pos;
+                HorseSet s = expr();
+                if (err.empty() && (pos >= toks.size() || toks[pos].text != ")")) err = "')' がありません";
+                ++pos;
+                return s;
+            }
+            return condition(toks[pos++]);
+        }
+
+        HorseSet condition(const Token& t) {
+            HorseSet s = empty();
+            const size_t colon = t.colon;
+            int lo, hi;
+            if (colon == std::string::npos) {                      // 従来の書き方
+                if (!t.quoted && isYearToken(t.text) && parseYears(t.text, lo, hi)) ix.byYear(lo, hi, s);
+                else if (ix.ped->find(t.text) != NO_HORSE) s.insert(ix.ped->find(t.text));
+                else err = "PrimaryKey \"" + t.text + "\" not found";
+                return s;
+            }
+            const std::string field = lower(t.text.substr(0, colon)), v = t.text.substr(colon + 1);
+            if (field == "year") {
+                if (parseYears(v, lo, hi)) ix.byYear(lo, hi, s);
+                else err = "年の書式: " + v;
+            }
+            else if (field == "sex") ix.bySex(v, s);
+            else if (field == "name") ix.byNamePrefix(v, s);
+            else if (field == "pk") {
+                const HorseId id = ix.ped->find(v);
+                if (id != NO_HORSE) s.insert(id);
+            }
+            else if (field == "sire" || field == "dam") {
+                std::vector<HorseId> ps;
+                ix.byHorse(v, ps);
+                if (ps.empty()) err = "馬 \"" + v + "\" not found";
+                for (HorseId p : ps) ix.byParent(p, field == "sire", s);
+            }
+            else err = "不明な項目: " + field;
+            return s;
+        }
+    };
+
+    const Pedigree* ped = nullptr;
+    std::vector<int> years;                                        // years[i] = 年(yearOrder[i])
+    std::unordered_map<std::string, std::vector<HorseId>> sexIds;
+    std::vector<HorseId> nameOrder;
+};
@@ -0,0 +1,159 @@
+﻿#pragma once
+//====================================================================
+//  topk.h  ―― 上位 K 頭だけを求める問い合わせ (行列を作らない)
+//
+//    ・TopKHeap       : 容量 K の有界ヒープ。順位 = 血量の降順 → PrimaryKey 昇順
+//    ・topDescendants : X の血を多く持つ子孫 K 頭。
+//        子の血量 = (父 + 母) / 2 ≦ max(父, 母) なので、K 位の値 T 以上の馬は
+//        必ず「T 以上の馬だけをたどる経路」で X から到達できる。
+//        → topo 順に展開し、血量が T 未満の馬の子は展開しない (枝刈り)。
+//        展開しなかった側の親の値が要るときだけ、親をさかのぼって求める (メモ化)
+//    ・topFromVector  : 祖先ベクトル (ancestry.h) から K 頭を選ぶ。
+//        祖先側には部分木の単調な上限が無いので、疎ベクトルを有界ヒープに流すだけ
+//    ※ topDescendants は ped.acyclic == true が前提
+//====================================================================
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "pedigree.h"
+
+using Ranked = std::vector<std::pair<HorseId, double>>;   // 順位順 (血量の降順)
+
+//  結果に含める馬の条件 (対象馬自身には掛けない)
+struct TopKFilter {
+    int yearLo = INT_MIN, yearHi = INT_MAX;   // 年の範囲 (指定時、年不明の馬は除外)
+    std::string sex;                          // 空 = 指定なし (英字は大小無視)
+
+    bool active() const { return yearLo != INT_MIN || yearHi != INT_MAX || !sex.empty(); }
+    bool pass(const Pedigree& ped, HorseId h) const {
+        if (yearLo != INT_MIN || yearHi != INT_MAX) {
+            const int y = ped.year[h];
+            if (y == INT_MIN || y < yearLo || y > yearHi) return false;
+        }
+        if (!sex.empty()) {
+            const std::string& s = ped.sex[h];
+            if (s.size() != sex.size()) return false;
+            for (size_t i = 0; i < s.size(); ++i)
+                if (std::tolower((unsigned char)s[i]) != std::tolower((unsigned char)sex[i])) return false;
+        }
+        return true;
+    }
+};
+
+struct TopKStats {
+    size_t visited = 0;    // 展開候補として取り出した子孫
+    size_t resolved = 0;   // 枝刈り側からさかのぼって値を求めた馬
+};
+
+class TopKHeap {
+public:
+    TopKHeap(const Pedigree& p, size_t k) : ped(p), k(k), heap(Worse{ &p }) {}
+
+    bool full() const { return k && heap.size() >= k; }
+    double threshold() const { return heap.top().second; }   // full() のときの K 位の値
+
+    // 上位 K に入るなら入れる (同値は PrimaryKey で比べる)
+    void offer(HorseId h, double v) {
+        if (!k) return;
+        if (heap.size() < k) { heap.emplace(h, v); return; }
+        if (Worse{ &ped }(std::make_pair(h, v), heap.top())) {
+            heap.pop();
+            heap.emplace(h, v);
+        }
+    }
+
+    void take(Ranked& out) {
+        out.clear();  out.reserve(heap.size());
+        for (; !heap.empty(); heap.pop()) out.push_back(heap.top());
+        std::reverse(out.begin(), out.end());
+    }
+
+private:
+    // a の方が順位が上 (= ヒープの根は最下位)
+    struct Worse {
+        const Pedigree* ped;
+        bool operator()(const std::pair<HorseId, double>& a, const std::pair<HorseId, double>& b) const {
+            return a.second != b.second ? a.second > b.second : ped->key[a.first] < ped->key[b.first];
+        }
+    };
+    const Pedigree& ped;
+    size_t k;
+    std::priority_queue<std::pair<HorseId, double>, std::vector<std::pair<HorseId, double>>, Worse> heap;
+};
+
+//  x の血を多く持つ子孫の上位 k 頭 (filter を通るものだけ)
+inline void topDescendants(const Pedigree& ped, HorseId x, size_t k, const TopKFilter& filter,
+    Ranked& out, TopKStats* st = nullptr)
+{
+    TopKStats local;
+    TopKStats& s = st ? *st : local;
+    const std::uint32_t px = ped.topoPos[x];
+
+    // 血量のメモ。X より topo が前の馬は X の子孫になり得ないので 0
+    std::unordered_map<HorseId, double> val{ { x, 1.0 } };
+    auto known = [&](HorseId p, double& v) {
+        if (p == NO_HORSE || ped.topoPos[p] < px) { v = 0.0;  return true; }
+        auto it = val.find(p);
+        if (it == val.end()) return false;
+        v = it->second;
+        return true;
+    };
+    // 展開されなかった親: 親をさかのぼって値を確定させる (再帰は明示スタックで)
+    std::vector<HorseId> stack;
+    auto resolve = [&](HorseId p) {
+        double v;
+        if (known(p, v)) return v;
+        stack.assign(1, p);
+        while (!stack.empty()) {
+            const HorseId h = stack.back();
+            if (val.count(h)) { stack.pop_back();  continue; }
+            double vs, vd;
+            const bool ks = known(ped.sire[h], vs), kd = known(ped.dam[h], vd);
+            if (ks && kd) {
+                val.emplace(h, 0.5 * vs + 0.5 * vd);
+                stack.pop_back();  ++s.resolved;
+                continue;
+            }
+            if (!ks) stack.push_back(ped.sire[h]);
+            if (!kd) stack.push_back(ped.dam[h]);
+        }
+        return val[p];
+    };
+
+    TopKHeap heap(ped, k);
+    auto later = [&](HorseId a, HorseId b) { return ped.topoPos[a] > ped.topoPos[b]; };
+    std::priority_queue<HorseId, std::vector<HorseId>, decltype(later)> pending(later);
+    std::unordered_set<HorseId> queued;       // 重複投入を避ける (子は両親から来うる)
+    auto expand = [&](HorseId h) {
+        for (const HorseId* c = ped.childrenBegin(h); c != ped.childrenEnd(h); ++c)
+            if (queued.insert(*c).second) pending.push(*c);
+    };
+    expand(x);
+    while (!pending.empty()) {
+        const HorseId h = pending.top();  pending.pop();
+        const double v = 0.5 * resolve(ped.sire[h]) + 0.5 * resolve(ped.dam[h]);
+        val.emplace(h, v);
+        ++s.visited;
+        if (filter.pass(ped, h)) heap.offer(h, v);
+        if (!heap.full() || v >= heap.threshold()) expand(h);
+    }
+    heap.take(out);
+}
+
+//  疎ベクトル (ID 昇順の {馬, 血量}) から self 以外の上位 k 頭
+inline void topFromVector(const Pedigree& ped, const std::vector<std::pair<HorseId, double>>& vec,
+    HorseId self, size_t k, const TopKFilter& filter, Ranked& out)
+{
+    TopKHeap heap(ped, k);
+    for (const auto& e : vec)
+        if (e.first != self && e.second > 0.0 && filter.pass(ped, e.first)) heap.offer(e.first, e.second);
+    heap.take(out);
+}